@@ -0,0 +1,111 @@
+//-----------------------------------------------------------------------------
+// bench_brick.c -- Flat vs. buddy engine on a random alloc/free workload.
+// Copyright (c) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "brick.h"
+
+
+//---------------------------------------------------------
+// SETTINGS:
+
+#define BENCH_BLOCKS     65536
+#define BENCH_BLOCK_SIZE 64
+#define BENCH_LIVE       2048
+#define BENCH_OPS        200000
+
+
+//---------------------------------------------------------
+// UTILITY FUNCTIONS:
+
+//xorshift32, so both engines see the same request stream.
+static uint32 benchRand(uint32* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+//Keeps BENCH_LIVE slots busy: each op frees a random slot and refills it with a request of 1 to `maxBlocks` blocks.
+//Mallocs are timed one by one, so the cheap failures of a full slab don't flatter the successful ones.
+static void benchRun(const char* name, uint32 engine, uint32 maxBlocks) {
+    static char* refs[BENCH_BLOCKS];
+    static uint32 live[BENCH_LIVE];
+    static uint32 liveBlocks[BENCH_LIVE];
+    brickContext bc;
+    char* memory     = malloc((size_t)BENCH_BLOCKS*BENCH_BLOCK_SIZE);
+    uint32 state     = 2463534242u;
+    uint32 failed    = 0;
+    uint32 slot      = 0;
+    uint32 blocks    = 0;
+    uint32 requested = 0;
+    uint32 reserved  = 0;
+    uint32 i         = 0;
+    double start     = 0;
+    double elapsed   = 0;
+    double okTime    = 0;
+    double failTime  = 0;
+
+    brickInitEngine(&bc, refs, memory, BENCH_BLOCKS, BENCH_BLOCK_SIZE, engine);
+    for(i = 0; i < BENCH_LIVE; i++) {
+        live[i] = BRICK_ALLOC_ERROR;
+    }
+
+    for(i = 0; i < BENCH_OPS; i++) {
+        slot = benchRand(&state) % BENCH_LIVE;
+        if(live[slot] != BRICK_ALLOC_ERROR) {
+            brickFree(&bc, live[slot]);
+        }
+        blocks = 1 + benchRand(&state) % maxBlocks;
+
+        start      = benchNow();
+        live[slot] = brickMalloc(&bc, blocks * BENCH_BLOCK_SIZE);
+        elapsed    = benchNow() - start;
+
+        liveBlocks[slot] = blocks;
+        if(live[slot] == BRICK_ALLOC_ERROR) {
+            failTime += elapsed;
+            failed++;
+        } else {
+            okTime += elapsed;
+        }
+    }
+
+    //what the live allocations asked for, against what they hold:
+    for(i = 0; i < BENCH_LIVE; i++) {
+        requested += (live[i] != BRICK_ALLOC_ERROR) ? liveBlocks[i] : 0;
+    }
+    for(i = 0; i < BENCH_BLOCKS; i++) {
+        reserved += (refs[i] != 0);
+    }
+
+    printf("%-6s max %3u blocks: %8.1f ns/malloc ok, %8.1f ns/malloc failed, %6u/%u failed, %4.1f%% of reserved blocks unused\n",
+           name, maxBlocks, okTime / (BENCH_OPS - failed), failed ? failTime / failed : 0.0, failed, BENCH_OPS,
+           reserved ? 100.0 * (reserved - requested) / reserved : 0.0);
+    free(memory);
+}
+
+//
+int main(int argc, char** argv) {
+    uint32 maxBlocks[] = {1, 8, 32, 56};
+    uint32 i = 0;
+
+    for(i = 0; i < sizeof(maxBlocks)/sizeof(maxBlocks[0]); i++) {
+        benchRun("flat",  BRICK_ENGINE_FLAT,  maxBlocks[i]);
+        benchRun("buddy", BRICK_ENGINE_BUDDY, maxBlocks[i]);
+    }
+
+    return 0;
+}
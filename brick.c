@@ -5,14 +5,314 @@
 //
 //-----------------------------------------------------------------------------
 
+//The optional features use POSIX and BSD calls (madvise, clock_gettime, pthread_condattr_setclock, robust mutexes) that strict -std=c99 builds hide;
+//ask for them before any system header comes in.
+#if !defined(_WIN32)
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE 1
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE 1
+#endif
+#endif //if !defined(_WIN32)
+
 #include "types.h"
 #include "brick.h"
 #include <string.h>
 
+#ifdef BRICK_TRACE_USDT
+#include <sys/sdt.h>
+#endif //ifdef BRICK_TRACE_USDT
+
+#ifdef BRICK_PURGE
+#if defined(_WIN32)
+#error BRICK_PURGE relies on madvise() and is only available on POSIX systems.
+#endif
+#include <sys/mman.h>
+#include <unistd.h>
+#endif //ifdef BRICK_PURGE
+
+#if defined(BRICK_CONCURRENT) && !defined(BRICK_COMPACT)
+#error BRICK_CONCURRENT makes compaction safe for concurrent readers; it needs BRICK_COMPACT defined too.
+#endif
+
+#ifdef BRICK_SHARED
+#if defined(_WIN32)
+#error BRICK_SHARED relies on process-shared pthread mutexes and is only available on POSIX systems.
+#endif
+#if defined(BRICK_GROWABLE) || defined(BRICK_BLOCK_STACK) || defined(BRICK_BUDDY) || defined(BRICK_COMPACT) || defined(BRICK_WAIT) || defined(BRICK_TAGS)
+#error BRICK_SHARED cannot be combined with features that keep allocator state in the (per-process) context.
+#endif
+#if defined(BRICK_PURGE) || defined(BRICK_CHECKPOINT) || defined(BRICK_IOVEC)
+#error BRICK_SHARED cannot be combined with per-process purge bits, dirty maps or lengths; madvise does not zero shared mappings either.
+#endif
+#include <errno.h>
+#endif //ifdef BRICK_SHARED
+
+#if defined(BRICK_WAIT) && !defined(_WIN32)
+#include <errno.h>
+#include <time.h>
+#endif //if defined(BRICK_WAIT) && !defined(_WIN32)
+
+#ifdef BRICK_CHECKPOINT
+#if defined(_WIN32)
+#include <io.h>
+#define brickWriteFd(fd, buf, n) _write((fd), (buf), (unsigned int)(n))
+#define brickReadFd(fd, buf, n)  _read((fd), (buf), (unsigned int)(n))
+#else
+#include <unistd.h>
+#define brickWriteFd(fd, buf, n) write((fd), (buf), (n))
+#define brickReadFd(fd, buf, n)  read((fd), (buf), (n))
+#endif
+#endif //ifdef BRICK_CHECKPOINT
+
+
+//---------------------------------------------------------
+//PLATFORM SUPPORT:
+
+#if defined(BRICK_TRACE) || defined(BRICK_CONCURRENT)
+#if defined(_MSC_VER)
+#include <intrin.h>
+//MSVC gives volatile accesses acquire/release semantics on x86/x64; the fences only need to stop the compiler.
+#define BRICK_LOAD_ACQUIRE(p)     (*(p))
+#define BRICK_STORE_RELEASE(p, v) (*(p) = (v))
+#define BRICK_FENCE_ACQUIRE()     _ReadWriteBarrier()
+#define BRICK_FENCE_RELEASE()     _ReadWriteBarrier()
+#else
+#define BRICK_LOAD_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define BRICK_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define BRICK_FENCE_ACQUIRE()     __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define BRICK_FENCE_RELEASE()     __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+#endif //if defined(BRICK_TRACE) || defined(BRICK_CONCURRENT)
+
+#ifdef BRICK_TRACE
+
+#if defined(_MSC_VER)
+#define BRICK_THREAD_LOCAL __declspec(thread)
+#else
+#define BRICK_THREAD_LOCAL __thread
+#endif
+
+//Cheapest available timestamp counter. Falls back to 0 where there is none.
+//brickCycles :: uint64
+static uint64 brickCycles(void) {
+#if defined(_MSC_VER)
+    return __rdtsc();
+#elif defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64 t;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return 0;
+#endif
+}
+
+#endif //ifdef BRICK_TRACE
+
+#ifdef BRICK_WAIT
+
+#if defined(_WIN32)
+#define brickMutexInit(m)     InitializeSRWLock(m)
+#define brickMutexLock(m)     AcquireSRWLockExclusive(m)
+#define brickMutexUnlock(m)   ReleaseSRWLockExclusive(m)
+#define brickMutexDestroy(m)  ((void)(m))
+#define brickCondInit(c)      InitializeConditionVariable(c)
+#define brickCondBroadcast(c) WakeAllConditionVariable(c)
+#define brickCondDestroy(c)   ((void)(c))
+#else
+#define brickMutexInit(m)     pthread_mutex_init((m), 0)
+#define brickMutexLock(m)     pthread_mutex_lock(m)
+#define brickMutexUnlock(m)   pthread_mutex_unlock(m)
+#define brickMutexDestroy(m)  pthread_mutex_destroy(m)
+#define brickCondBroadcast(c) pthread_cond_broadcast(c)
+#define brickCondDestroy(c)   pthread_cond_destroy(c)
+
+//Sets up a wait condition whose timed waits run on CLOCK_MONOTONIC, like brickNowMs(), so
+//setting the wall clock neither cuts short nor stretches a brickMallocWait().
+//brickCondInit :: brickCond* -> Effect
+static void brickCondInit(brickCond* cond) {
+#if defined(__APPLE__)
+    //no pthread_condattr_setclock here: brickCondWaitUntil() waits with a relative timeout instead.
+    pthread_cond_init(cond, 0);
+#else
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+#endif
+}
+#endif
+
+//Milliseconds on the clock brickCondWaitUntil() measures deadlines against.
+//brickNowMs :: uint64
+static uint64 brickNowMs(void) {
+#if defined(_WIN32)
+    return GetTickCount64();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+#endif
+}
+
+#define BRICK_DEADLINE_NONE 0xFFFFFFFFFFFFFFFFULL
+
+//Waits on `ctx`'s wait condition (holding its lock) until woken, or until the brickNowMs() time `deadline`
+//(BRICK_DEADLINE_NONE: no deadline). Returns 0 once the deadline has passed.
+//brickCondWaitUntil :: brickContext* -> uint64 -> Effect -> uint32
+static uint32 brickCondWaitUntil(brickContext* ctx, uint64 deadline) {
+    uint64 now = brickNowMs();
+
+    if(deadline == BRICK_DEADLINE_NONE) {
+#if defined(_WIN32)
+        SleepConditionVariableSRW(&ctx->waitCond, &ctx->waitLock, INFINITE, 0);
+#else
+        pthread_cond_wait(&ctx->waitCond, &ctx->waitLock);
+#endif
+        return 1;
+    }
+    if(now >= deadline) {
+        return 0;
+    }
+#if defined(_WIN32)
+    return SleepConditionVariableSRW(&ctx->waitCond, &ctx->waitLock, (DWORD)(deadline-now), 0) || (GetLastError() != ERROR_TIMEOUT);
+#else
+    {
+        struct timespec ts;
+
+#if defined(__APPLE__)
+        ts.tv_sec  = (time_t)((deadline-now) / 1000);
+        ts.tv_nsec = (long)((deadline-now) % 1000) * 1000000;
+        return pthread_cond_timedwait_relative_np(&ctx->waitCond, &ctx->waitLock, &ts) != ETIMEDOUT;
+#else
+        ts.tv_sec  = (time_t)(deadline / 1000);
+        ts.tv_nsec = (long)(deadline % 1000) * 1000000;
+        return pthread_cond_timedwait(&ctx->waitCond, &ctx->waitLock, &ts) != ETIMEDOUT;
+#endif
+    }
+#endif
+}
+
+#endif //ifdef BRICK_WAIT
+
+#ifdef BRICK_SHARED
+
+//Takes a shared context's cross-process lock. If its last owner died holding it, the lock is just taken over:
+//the pointer array is written one whole entry at a time, so at worst the allocation it was making or freeing leaks.
+//brickSharedLock :: brickContext* -> Effect
+static void brickSharedLock(brickContext* ctx) {
+    if(ctx->shared && (pthread_mutex_lock(&ctx->shared->lock) == EOWNERDEAD)) {
+        pthread_mutex_consistent(&ctx->shared->lock);
+    }
+}
+
+//brickSharedUnlock :: brickContext* -> Effect
+static void brickSharedUnlock(brickContext* ctx) {
+    if(ctx->shared) {
+        pthread_mutex_unlock(&ctx->shared->lock);
+    }
+}
+
+#endif //ifdef BRICK_SHARED
+
+
+//---------------------------------------------------------
+//TRACING:
+
+#ifdef BRICK_TRACE
+
+static BRICK_THREAD_LOCAL brickTraceRing brickLocalTraceRing;
+
+//Pushes an event onto the calling thread's ring and hands it to the context's hook.
+//brickTraceRecord :: brickContext* -> uint32 -> uint32 -> uint32 -> uint64 -> Effect
+static void brickTraceRecord(brickContext* ctx, uint32 op, uint32 key, uint32 blocks, uint64 cycles) {
+    brickTraceRing* ring = &brickLocalTraceRing;
+    uint32 head          = ring->head;
+    brickTraceEvent* ev  = &ring->events[head & (BRICK_TRACE_RING_SIZE-1)];
+
+    if(head - BRICK_LOAD_ACQUIRE(&ring->tail) >= BRICK_TRACE_RING_SIZE) {
+        ring->dropped++;
+    } else {
+        ev->ctx    = ctx;
+        ev->op     = op;
+        ev->key    = key;
+        ev->blocks = blocks;
+        ev->cycles = cycles;
+        BRICK_STORE_RELEASE(&ring->head, head+1);
+    }
+
+    if(ctx->traceHook) {
+        brickTraceEvent local;
+        local.ctx    = ctx;
+        local.op     = op;
+        local.key    = key;
+        local.blocks = blocks;
+        local.cycles = cycles;
+        ctx->traceHook(ctx, &local, ctx->traceUserData);
+    }
+}
+
+#ifdef BRICK_TRACE_USDT
+#define BRICK_TRACE_EVENT(ctx, probe, op, key, blocks, cycles) do { \
+        DTRACE_PROBE4(brick, probe, (ctx), (key), (blocks), (cycles)); \
+        brickTraceRecord((ctx), (op), (key), (blocks), (cycles)); \
+    } while(0)
+#else
+#define BRICK_TRACE_EVENT(ctx, probe, op, key, blocks, cycles) brickTraceRecord((ctx), (op), (key), (blocks), (cycles))
+#endif //ifdef BRICK_TRACE_USDT
+
+#endif //ifdef BRICK_TRACE
+
 
 //---------------------------------------------------------
 //UTILITY FUNCTIONS:
 
+//Walks the chain of slabs behind a context (just the context itself, unless it is growable),
+//and builds the key for a block in one of them.
+#ifdef BRICK_GROWABLE
+#define BRICK_NEXT_SLAB(slab)       ((slab)->next)
+#define BRICK_SLAB_KEY(slab, block) (((slab)->slabIndex << BRICK_SLAB_SHIFT) | (block))
+#else
+#define BRICK_NEXT_SLAB(slab)       ((brickContext*)0)
+#define BRICK_SLAB_KEY(slab, block) (block)
+#endif //ifdef BRICK_GROWABLE
+
+//What the pointer array holds for the blocks of an allocation starting at `block`, and the address it stands for.
+//Shared contexts are mapped at a different address in every process, so they store the start block + 1 instead.
+#ifdef BRICK_SHARED
+#define BRICK_BLOCK_REF(slab, block) ((char*)(size_t)((uint64)(block)+1))
+#define BRICK_REF_PTR(slab, ref)     (&(slab)->memory[((uint64)(size_t)(ref)-1)*(slab)->blockSize])
+#else
+#define BRICK_BLOCK_REF(slab, block) (&(slab)->memory[(uint64)(block)*(slab)->blockSize])
+#define BRICK_REF_PTR(slab, ref)     (ref)
+#endif //ifdef BRICK_SHARED
+
+//Bit twiddling for the per-block bitmaps some options keep.
+#define BRICK_BIT_TEST(map, i)  ((map)[(i) >> 5] &   (1u << ((i) & 31)))
+#define BRICK_BIT_SET(map, i)   ((map)[(i) >> 5] |=  (1u << ((i) & 31)))
+#define BRICK_BIT_CLEAR(map, i) ((map)[(i) >> 5] &= ~(1u << ((i) & 31)))
+
+#ifdef BRICK_CHECKPOINT
+//Flags blocks [first, last) of a slab as changed since the last checkpoint.
+#define BRICK_MARK_DIRTY(slab, first, last) do { \
+        uint32 dirtyBlock_ = (first); \
+        if((slab)->dirtyMap) { \
+            for(; dirtyBlock_ < (last); dirtyBlock_++) { BRICK_BIT_SET((slab)->dirtyMap, dirtyBlock_); } \
+        } \
+    } while(0)
+#else
+#define BRICK_MARK_DIRTY(slab, first, last)
+#endif //ifdef BRICK_CHECKPOINT
+
 //Simple round up to nearest multiple function. Based off of Swedish currency rounding.
 //swedeRoundUp :: uint32 -> uint32 -> uint32
 uint32 swedeRoundUp(uint32 x, uint32 multiple) {
@@ -27,118 +327,2307 @@ uint32 swedeRoundUp(uint32 x, uint32 multiple) {
 
 
 //---------------------------------------------------------
-// FUNCTION IMPLEMENTATIONS:
+//FREE STACK:
 
-//Returns an unsigned integer key into the list of allocation ptrs.
-// usage: char* blockptrs[numberofblocksinlist]; uint32 key = blockalloc(size);
-//on dealloc: charptr is zeroed out.
-//on alloc: since numblocks == numblockptrs, we set all "dirty" blockptrs to point to the start of the region.
-//search for open blocks by doing a linear search of the blockptrs array.
+#ifdef BRICK_BLOCK_STACK
+//Empties a slab's free stack. The blocks stay free; they just stop being cached.
+//brickStackReset :: brickContext* -> Effect
+static void brickStackReset(brickContext* slab) {
+    slab->stackTop  = BRICK_ALLOC_ERROR;
+    slab->stackLow  = BRICK_ALLOC_ERROR;
+    slab->stackHigh = 0;
+}
 
 
-//Zeroes out initial memory of the pointer array, and sets the context's reference to the slab of memory.
-//brickInit :: brickContext* -> [char*] -> char* -> uint32 -> uint32 -> Effect
-void brickInit(brickContext* ctx, char** blockPtrList, char* memory, uint32 numBlocks, uint32 blockSize) {
-    uint32 i          = 0;
-    ctx->blockptrlist = blockPtrList;
-    ctx->memory       = memory;
-    ctx->numBlocks    = numBlocks;
-    ctx->blockSize    = blockSize;
+#ifndef BRICK_ZERO_WRITE_DEST_BLOCKS
+//Pushes a freed single-block allocation onto its slab's free stack, linking it through its own memory.
+//brickStackPush :: brickContext* -> uint32 -> Effect
+static void brickStackPush(brickContext* slab, uint32 block) {
+    if(slab->blockSize < sizeof(uint32)) {
+        return;
+    }
 
-    for(; i < numBlocks; i++) {
-        ctx->blockptrlist[i] = 0;
+    memcpy(&slab->memory[block*slab->blockSize], &slab->stackTop, sizeof(uint32));
+    slab->stackTop  = block;
+    slab->stackLow  = (block < slab->stackLow)  ? block : slab->stackLow;
+    slab->stackHigh = (block > slab->stackHigh) ? block : slab->stackHigh;
+}
+#endif //ifndef BRICK_ZERO_WRITE_DEST_BLOCKS
+
+
+//Pops the most recently freed single block off a slab's free stack.
+//Returns its block index, or BRICK_ALLOC_ERROR if the stack is empty.
+//brickStackPop :: brickContext* -> Effect -> uint32
+static uint32 brickStackPop(brickContext* slab) {
+    uint32 block = slab->stackTop;
+
+    if(block != BRICK_ALLOC_ERROR) {
+        memcpy(&slab->stackTop, &slab->memory[block*slab->blockSize], sizeof(uint32));
     }
+
+    return block;
 }
+#endif //ifdef BRICK_BLOCK_STACK
 
 
-//Returns the starting index/key of the first fit for an allocation of length `length`.
-//Returns 0 on failure, 1+ on success. (thus, our indexes start at 1, much like in Lua.)
-//brickFindOpenRun :: brickContext* -> uint32 -> uint32
-uint32 brickFindOpenRun(brickContext* ctx, uint32 length) {
-    uint32 i          = 0;
-    uint32 currentRun = 0;
+//---------------------------------------------------------
+//BUDDY ENGINE:
 
-    for(; i < ctx->numBlocks; i++) {
-        if(ctx->blockptrlist[i] == 0) {
-            currentRun++;
-            if(currentRun == length) {
-                i -= (currentRun-1);
-                i++; //start indexes at 1+
-                break;
-            }
+#ifdef BRICK_BUDDY
+
+//Free-list node kept in the first block of every free buddy block.
+typedef struct brickBuddyNode {
+    uint32 next;
+    uint32 prev;
+    uint32 order;
+} brickBuddyNode;
+
+#define BRICK_BUDDY_NIL BRICK_ALLOC_ERROR
+
+//Nodes live in block memory of unknown alignment, so they are always copied in and out.
+#define BRICK_BUDDY_READ(slab, block, node)  memcpy((node), &(slab)->memory[(uint64)(block)*(slab)->blockSize], sizeof(brickBuddyNode))
+#define BRICK_BUDDY_WRITE(slab, block, node) memcpy(&(slab)->memory[(uint64)(block)*(slab)->blockSize], (node), sizeof(brickBuddyNode))
+
+
+//Returns the smallest order whose blocks hold `blocks` blocks.
+//brickBuddyOrder :: uint32 -> uint32
+static uint32 brickBuddyOrder(uint32 blocks) {
+    uint32 order = 0;
+
+    while(((uint64)1 << order) < blocks) {
+        order++;
+    }
+
+    return order;
+}
+
+
+//Pushes the free block of order `order` at `block` onto its free list.
+//brickBuddyPush :: brickContext* -> uint32 -> uint32 -> Effect
+static void brickBuddyPush(brickContext* slab, uint32 block, uint32 order) {
+    brickBuddyNode node;
+    brickBuddyNode next;
+
+    node.next  = slab->buddyFree[order];
+    node.prev  = BRICK_BUDDY_NIL;
+    node.order = order;
+
+    if(node.next != BRICK_BUDDY_NIL) {
+        BRICK_BUDDY_READ(slab, node.next, &next);
+        next.prev = block;
+        BRICK_BUDDY_WRITE(slab, node.next, &next);
+    }
+
+    slab->buddyFree[order] = block;
+    BRICK_BUDDY_WRITE(slab, block, &node);
+}
+
+
+//Unlinks the free block at `block` (whose node is `node`) from its free list.
+//brickBuddyUnlink :: brickContext* -> uint32 -> brickBuddyNode* -> Effect
+static void brickBuddyUnlink(brickContext* slab, uint32 block, brickBuddyNode* node) {
+    brickBuddyNode other;
+
+    if(node->prev != BRICK_BUDDY_NIL) {
+        BRICK_BUDDY_READ(slab, node->prev, &other);
+        other.next = node->next;
+        BRICK_BUDDY_WRITE(slab, node->prev, &other);
+    } else {
+        slab->buddyFree[node->order] = node->next;
+    }
+
+    if(node->next != BRICK_BUDDY_NIL) {
+        BRICK_BUDDY_READ(slab, node->next, &other);
+        other.prev = node->prev;
+        BRICK_BUDDY_WRITE(slab, node->next, &other);
+    }
+
+#ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
+    memset(&slab->memory[(uint64)block*slab->blockSize], '\0', sizeof(brickBuddyNode));
+#endif //ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
+}
+
+
+//Takes a free block of order `order` off the free lists, splitting a bigger one if need be.
+//Returns its block index, or BRICK_ALLOC_ERROR if nothing big enough is free.
+//brickBuddyCarve :: brickContext* -> uint32 -> Effect -> uint32
+static uint32 brickBuddyCarve(brickContext* slab, uint32 order) {
+    brickBuddyNode node;
+    uint32 k     = order;
+    uint32 block = 0;
+
+    while((k < BRICK_BUDDY_ORDERS) && (slab->buddyFree[k] == BRICK_BUDDY_NIL)) {
+        k++;
+    }
+    if(k >= BRICK_BUDDY_ORDERS) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    block = slab->buddyFree[k];
+    BRICK_BUDDY_READ(slab, block, &node);
+    brickBuddyUnlink(slab, block, &node);
+
+    //hand the upper halves back as we split down:
+    while(k > order) {
+        k--;
+        brickBuddyPush(slab, block + (1u << k), k);
+    }
+
+    return block;
+}
+
+
+//Returns a just-freed block of `blocks` blocks to the free lists, merging it with its buddy for as long as the buddy is free.
+//brickBuddyRelease :: brickContext* -> uint32 -> uint32 -> Effect
+static void brickBuddyRelease(brickContext* slab, uint32 block, uint32 blocks) {
+    brickBuddyNode node;
+    uint32 order = brickBuddyOrder(blocks);
+    uint32 buddy = 0;
+
+    while(order+1 < BRICK_BUDDY_ORDERS) {
+        buddy = block ^ (1u << order);
+        if(((uint64)buddy + (1u << order) > slab->numBlocks) || (slab->blockptrlist[buddy] != 0)) {
+            break;
+        }
+        //a free buddy always heads a free block; merge only if that block is whole:
+        BRICK_BUDDY_READ(slab, buddy, &node);
+        if(node.order != order) {
+            break;
+        }
+        brickBuddyUnlink(slab, buddy, &node);
+        block &= ~(1u << order);
+        order++;
+    }
+
+    brickBuddyPush(slab, block, order);
+}
+
+
+//Rebuilds a slab's free lists from its pointer array, carving each free run into the largest aligned blocks that fit.
+//brickBuddyRebuild :: brickContext* -> Effect
+static void brickBuddyRebuild(brickContext* slab) {
+    uint32 i     = 0;
+    uint32 last  = 0;
+    uint32 order = 0;
+
+    for(i = 0; i < BRICK_BUDDY_ORDERS; i++) {
+        slab->buddyFree[i] = BRICK_BUDDY_NIL;
+    }
+
+    for(i = 0; i < slab->numBlocks; ) {
+        if(slab->blockptrlist[i] != 0) {
+            i++;
             continue;
         }
-        //Implicit else:
-        currentRun = 0;
+        for(last = i; (last < slab->numBlocks) && (slab->blockptrlist[last] == 0); last++) { continue; }
+
+        while(i < last) {
+            for(order = 0; (order+1 < BRICK_BUDDY_ORDERS) && !(i & ((1u << (order+1))-1)) && ((uint64)i + (1u << (order+1)) <= last); order++) { continue; }
+            brickBuddyPush(slab, i, order);
+            i += 1u << order;
+        }
     }
+}
 
-    return i;
+#define BRICK_FLAT(slab) ((slab)->engine == BRICK_ENGINE_FLAT)
+#else
+#define BRICK_FLAT(slab) 1
+#endif //ifdef BRICK_BUDDY
+
+
+//---------------------------------------------------------
+//PURGING:
+
+#ifdef BRICK_PURGE
+
+#ifdef BRICK_PURGE_MADV_FREE
+#define BRICK_PURGE_ADVICE MADV_FREE
+#else
+#define BRICK_PURGE_ADVICE MADV_DONTNEED
+#endif //ifdef BRICK_PURGE_MADV_FREE
+
+//Returns the size of an OS page, asking the OS only once.
+//brickPageSize :: size_t
+static size_t brickPageSize(void) {
+    static size_t pageSize = 0;
+
+    if(!pageSize) {
+        pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    return pageSize;
 }
 
 
-//Returns a key for later access into the index.
-//Returns BRICK_ALLOC_ERROR on failure.
-//blockMalloc :: brickContext -> uint32 -> Effect -> uint32
-uint32 brickMalloc(brickContext* ctx, uint32 size) {
-    uint32 i            = 0;
-    uint32 key          = 0;
-    uint32 blocksNeeded = swedeRoundUp(size, ctx->blockSize);
+//Releases the whole pages inside the free blocks [first, last) to the OS, and marks
+//the blocks lying entirely within those pages as purged. Returns the number of bytes released.
+//brickPurgeRange :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+static uint32 brickPurgeRange(brickContext* slab, uint32 first, uint32 last) {
+    size_t pageSize = brickPageSize();
+    size_t base     = (size_t)slab->memory;
+    size_t start    = base + (size_t)first*slab->blockSize;
+    size_t end      = base + (size_t)last*slab->blockSize;
+    uint32 i        = 0;
 
-    blocksNeeded = blocksNeeded / ctx->blockSize;
+    //shrink to whole pages:
+    start = (start + pageSize-1) & ~(pageSize-1);
+    end   = end & ~(pageSize-1);
+    if(end <= start) {
+        return 0;
+    }
+
+    //shrink to whole blocks, and skip the call if they are all purged already:
+    first = (uint32)((start - base + slab->blockSize-1) / slab->blockSize);
+    last  = (uint32)((end - base) / slab->blockSize);
+    for(i = first; (i < last) && BRICK_BIT_TEST(slab->purgeMap, i); i++) { continue; }
+    if((i == last) && (first != last)) {
+        return 0;
+    }
 
-    key = brickFindOpenRun(ctx, blocksNeeded);
+#ifdef BRICK_BLOCK_STACK
+    //purged pages lose the stack's links:
+    brickStackReset(slab);
+#endif //ifdef BRICK_BLOCK_STACK
 
-    //allocation failure case:
-    if(!key) {
-        key = BRICK_ALLOC_ERROR;
-        goto endpoint;
+    if(madvise((void*)start, end - start, BRICK_PURGE_ADVICE) != 0) {
+        return 0;
     }
 
-    //subtract 1 to obtain true start index location, and write pointers:
-    key -= 1;
-    for(i = key; i < key+blocksNeeded; i++) {
-        ctx->blockptrlist[i] = &ctx->memory[key*ctx->blockSize]; //FINISH!!
+#ifndef BRICK_PURGE_MADV_FREE
+    //MADV_DONTNEED'd anonymous pages come back zero-filled, so later callocs can skip them:
+    for(i = first; i < last; i++) {
+        BRICK_BIT_SET(slab->purgeMap, i);
     }
+#endif //ifndef BRICK_PURGE_MADV_FREE
 
-endpoint:
-    return key;
+    return (uint32)(end - start);
 }
 
 
-//"Frees" memory by zeroing out the pointers in the pointer array.
-//NOTE: if BRICK_ZERO_WRITE_DEST_BLOCKS is set, then the blocks of memory will also be zeroed out.
-//blockFree :: brickContext* -> uint32 -> Effect
-void brickFree(brickContext* ctx, uint32 key) {
-    uint32 i     = key;
-    char* keyval = ctx->blockptrlist[key];
+//Purges every free run in a slab that spans at least `minBytes`. Returns the number of bytes released.
+//brickPurgeSlab :: brickContext* -> uint32 -> Effect -> uint32
+static uint32 brickPurgeSlab(brickContext* slab, uint32 minBytes) {
+    uint32 i        = 0;
+    uint32 runStart = 0;
+    uint32 released = 0;
 
-#ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
-    //determine number of blocks to write to, accumulating the count in `i`:
-    for(; (i < ctx->numBlocks) && (ctx->blockptrlist[i] == keyval); i++) { continue; }
+    //free buddy blocks keep their list nodes in their memory:
+    if(!slab->purgeMap || !BRICK_FLAT(slab)) {
+        return 0;
+    }
 
-    //zero-write over the blocks:
-    memset(keyval, '\0', i*ctx->blockSize);
-    
-    //reset the state of i for the normal path of execution:
-    i = key;
+    while(i < slab->numBlocks) {
+        if(slab->blockptrlist[i] != 0) {
+            i++;
+            continue;
+        }
+        for(runStart = i; (i < slab->numBlocks) && (slab->blockptrlist[i] == 0); i++) { continue; }
+        if((uint64)(i - runStart)*slab->blockSize >= minBytes) {
+            released += brickPurgeRange(slab, runStart, i);
+        }
+    }
 
-#endif //ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
+    return released;
+}
 
-    for(; i < ctx->numBlocks; i++) {
-        if(ctx->blockptrlist[i] == keyval) {
-            ctx->blockptrlist[i] = 0;
+#endif //ifdef BRICK_PURGE
+
+
+//---------------------------------------------------------
+//CHECKPOINTING:
+
+#ifdef BRICK_CHECKPOINT
+
+//Checkpoint stream layout (native byte order): a brickCheckpointHeader, then `numRuns` runs.
+//Each run is a brickCheckpointRun, `count` uint32 metadata entries (start block of the owning
+//allocation + 1, or 0 for a free block), then the `count` blocks of memory themselves.
+#define BRICK_CHECKPOINT_MAGIC 0x4B435242 //"BRCK"
+
+typedef struct brickCheckpointHeader {
+    uint32 magic;
+    uint32 epoch;
+    uint32 numBlocks;
+    uint32 blockSize;
+    uint32 numRuns;
+} brickCheckpointHeader;
+
+typedef struct brickCheckpointRun {
+    uint32 first;
+    uint32 count;
+} brickCheckpointRun;
+
+//Metadata entries are converted in chunks of this many on the stack.
+#define BRICK_CHECKPOINT_CHUNK 1024
+
+
+//Writes all of `buf`, riding out short writes. Returns 1 on success, 0 on failure.
+//brickWriteAll :: int -> void* -> uint64 -> Effect -> uint32
+static uint32 brickWriteAll(int fd, const void* buf, uint64 length) {
+    const char* p = (const char*)buf;
+    long n        = 0;
+
+    while(length) {
+        n = (long)brickWriteFd(fd, p, (length > 0x40000000) ? 0x40000000 : length);
+        if(n <= 0) {
+            return 0;
+        }
+        p      += n;
+        length -= (uint64)n;
+    }
+
+    return 1;
+}
+
+
+//Fills all of `buf`, riding out short reads. Returns 1 on success, 0 on failure or a clean EOF.
+//brickReadAll :: int -> void* -> uint64 -> Effect -> uint32
+static uint32 brickReadAll(int fd, void* buf, uint64 length) {
+    char* p = (char*)buf;
+    long n  = 0;
+
+    while(length) {
+        n = (long)brickReadFd(fd, p, (length > 0x40000000) ? 0x40000000 : length);
+        if(n <= 0) {
+            return 0;
+        }
+        p      += n;
+        length -= (uint64)n;
+    }
+
+    return 1;
+}
+
+
+//Finds the next run of dirty blocks at or after `*first`. Returns the end of the run,
+//with `*first` moved to its start, or 0 if no dirty blocks are left.
+//brickNextDirtyRun :: brickContext* -> uint32* -> uint32
+static uint32 brickNextDirtyRun(brickContext* ctx, uint32* first) {
+    uint32 i = *first;
+
+    while(i < ctx->numBlocks) {
+        //skip clean words whole:
+        if(!ctx->dirtyMap[i >> 5]) {
+            i = (i | 31) + 1;
             continue;
         }
-        break;
+        if(BRICK_BIT_TEST(ctx->dirtyMap, i)) {
+            break;
+        }
+        i++;
     }
+    if(i >= ctx->numBlocks) {
+        return 0;
+    }
+
+    *first = i;
+    for(; (i < ctx->numBlocks) && BRICK_BIT_TEST(ctx->dirtyMap, i); i++) { continue; }
+
+    return i;
 }
 
 
-//A full, stop-the-world compaction of the blocklist.
-//CONCURRENCY NOTE: Needs to be wrapped in a mutex or critical section for safe use.
-//brickGC :: brickContext* -> Effect
-void brickGC(brickContext* ctx) {
+//Writes one run of dirty blocks: its header, its metadata, then its memory in one go.
+//brickCheckpointRunOut :: brickContext* -> int -> uint32 -> uint32 -> Effect -> uint32
+static uint32 brickCheckpointRunOut(brickContext* ctx, int fd, uint32 first, uint32 last) {
+    uint32 meta[BRICK_CHECKPOINT_CHUNK];
+    brickCheckpointRun run;
+    uint32 i = first;
+    uint32 n = 0;
+
+    run.first = first;
+    run.count = last - first;
+    if(!brickWriteAll(fd, &run, sizeof(run))) {
+        return 0;
+    }
+
+    while(i < last) {
+        for(n = 0; (n < BRICK_CHECKPOINT_CHUNK) && (i < last); n++, i++) {
+            meta[n] = ctx->blockptrlist[i] ? (uint32)((BRICK_REF_PTR(ctx, ctx->blockptrlist[i]) - ctx->memory) / ctx->blockSize) + 1 : 0;
+        }
+        if(!brickWriteAll(fd, meta, n*sizeof(uint32))) {
+            return 0;
+        }
+    }
+
+    return brickWriteAll(fd, &ctx->memory[(uint64)first*ctx->blockSize], (uint64)(last-first)*ctx->blockSize);
+}
+
+
+//Reads one run back into the context. Returns 1 on success, 0 on a short or malformed run.
+//brickRestoreRun :: brickContext* -> int -> Effect -> uint32
+static uint32 brickRestoreRun(brickContext* ctx, int fd) {
+    uint32 meta[BRICK_CHECKPOINT_CHUNK];
+    brickCheckpointRun run;
+    uint32 i = 0;
+    uint32 j = 0;
+    uint32 n = 0;
+
+    if(!brickReadAll(fd, &run, sizeof(run))) {
+        return 0;
+    }
+    if((run.first > ctx->numBlocks) || (run.count > ctx->numBlocks - run.first)) {
+        return 0;
+    }
+
+    for(i = run.first; i < run.first+run.count; i += n) {
+        n = run.first+run.count - i;
+        n = (n > BRICK_CHECKPOINT_CHUNK) ? BRICK_CHECKPOINT_CHUNK : n;
+        if(!brickReadAll(fd, meta, n*sizeof(uint32))) {
+            return 0;
+        }
+        for(j = 0; j < n; j++) {
+            if(meta[j] > ctx->numBlocks) {
+                return 0;
+            }
+            ctx->blockptrlist[i+j] = meta[j] ? BRICK_BLOCK_REF(ctx, meta[j]-1) : 0;
+        }
+    }
+
+#ifdef BRICK_PURGE
+    //restored blocks hold real data again:
+    if(ctx->purgeMap) {
+        for(i = run.first; i < run.first+run.count; i++) {
+            BRICK_BIT_CLEAR(ctx->purgeMap, i);
+        }
+    }
+#endif //ifdef BRICK_PURGE
+
+    return brickReadAll(fd, &ctx->memory[(uint64)run.first*ctx->blockSize], (uint64)run.count*ctx->blockSize);
+}
+
+#endif //ifdef BRICK_CHECKPOINT
+
+
+//---------------------------------------------------------
+//REGIONS:
+
+#ifdef BRICK_REGIONS
+
+//Scope marks sit in the region log between the keys, so nested scopes need no other bookkeeping.
+#define BRICK_REGION_MARK BRICK_ALLOC_ERROR
+
+#ifdef BRICK_COMPACT
+//Points the region log entry for `oldKey` (if there is one) at `newKey`, after compaction moved it.
+//brickRegionRekey :: brickContext* -> uint32 -> uint32 -> Effect
+static void brickRegionRekey(brickContext* ctx, uint32 oldKey, uint32 newKey) {
+    uint32 i = ctx->regionLength;
+
+    while(ctx->regionDepth && i--) {
+        if(ctx->regionLog[i] == oldKey) {
+            ctx->regionLog[i] = newKey;
+            return;
+        }
+    }
+}
+#endif //ifdef BRICK_COMPACT
+
+#endif //ifdef BRICK_REGIONS
+
+
+//---------------------------------------------------------
+//TAGS:
+
+#ifdef BRICK_TAGS
+
+static brickContext* brickResolve(brickContext* ctx, uint32 key, uint32* block);
+
+//Returns the tag link of the allocation at `key`, or 0 if its slab has no links attached.
+//brickTagLinkOf :: brickContext* -> uint32 -> brickTagLink*
+static brickTagLink* brickTagLinkOf(brickContext* ctx, uint32 key) {
+    uint32 block       = 0;
+    brickContext* slab = brickResolve(ctx, key, &block);
+
+    return (slab && slab->tagLinks) ? &slab->tagLinks[block] : 0;
+}
+
+
+//Puts the allocation at `key` at the head of `tag`'s list, and charges its blocks to the tag.
+//brickTagPush :: brickContext* -> brickTagLink* -> uint32 -> uint32 -> uint32 -> Effect
+static void brickTagPush(brickContext* ctx, brickTagLink* link, uint32 key, uint32 tag, uint32 blocks) {
+    brickTag* t = &ctx->tags[tag];
+
+    link->tag    = tag;
+    link->blocks = blocks;
+    link->prev   = BRICK_TAG_NONE;
+    link->next   = t->head;
+    if(t->head != BRICK_TAG_NONE) {
+        brickTagLinkOf(ctx, t->head)->prev = key;
+    }
+    t->head    = key;
+    t->blocks += blocks;
+}
+
+
+//Takes a tagged allocation off its tag's list and gives its blocks back to the tag.
+//brickTagUnlink :: brickContext* -> brickTagLink* -> Effect
+static void brickTagUnlink(brickContext* ctx, brickTagLink* link) {
+    brickTag* t = &ctx->tags[link->tag];
+
+    if(link->prev != BRICK_TAG_NONE) {
+        brickTagLinkOf(ctx, link->prev)->next = link->next;
+    } else {
+        t->head = link->next;
+    }
+    if(link->next != BRICK_TAG_NONE) {
+        brickTagLinkOf(ctx, link->next)->prev = link->prev;
+    }
+
+    t->blocks -= link->blocks;
+    link->tag  = BRICK_TAG_NONE;
+}
+
+
+#ifdef BRICK_COMPACT
+//Moves the tag link of an allocation that compaction moved from block `from` of `slab` to block `to`.
+//brickTagMove :: brickContext* -> brickContext* -> uint32 -> uint32 -> Effect
+static void brickTagMove(brickContext* ctx, brickContext* slab, uint32 from, uint32 to) {
+    uint32 newKey = BRICK_SLAB_KEY(slab, to);
+    brickTagLink link;
+
+    if(!slab->tagLinks || (slab->tagLinks[from].tag == BRICK_TAG_NONE)) {
+        return;
+    }
+
+    link = slab->tagLinks[from];
+    slab->tagLinks[from].tag = BRICK_TAG_NONE;
+    slab->tagLinks[to]       = link;
+
+    if(link.prev != BRICK_TAG_NONE) {
+        brickTagLinkOf(ctx, link.prev)->next = newKey;
+    } else {
+        ctx->tags[link.tag].head = newKey;
+    }
+    if(link.next != BRICK_TAG_NONE) {
+        brickTagLinkOf(ctx, link.next)->prev = newKey;
+    }
+}
+#endif //ifdef BRICK_COMPACT
+
+#endif //ifdef BRICK_TAGS
+
+
+//---------------------------------------------------------
+//COMPACTION:
+
+#ifdef BRICK_COMPACT
+
+//Returns the start of the first free run at or after `from` (numBlocks if there is none), and puts its end in `end`.
+//brickNextFreeRun :: brickContext* -> uint32 -> uint32* -> uint32
+static uint32 brickNextFreeRun(brickContext* slab, uint32 from, uint32* end) {
+    while((from < slab->numBlocks) && slab->blockptrlist[from]) {
+        from++;
+    }
+    for(*end = from; (*end < slab->numBlocks) && !slab->blockptrlist[*end]; (*end)++) { continue; }
+
+    return from;
+}
+
+
+//Finds the window [first, last), running from the start of one free run to the end of another, that holds
+//at least `need` free blocks with the fewest allocated blocks in between (those are what has to move).
+//Returns the number of allocated blocks in it, or BRICK_ALLOC_ERROR if the slab doesn't have `need` free blocks.
+//brickCompactWindow :: brickContext* -> uint32 -> uint32* -> uint32* -> uint32
+static uint32 brickCompactWindow(brickContext* slab, uint32 need, uint32* first, uint32* last) {
+    uint32 loStart    = 0;
+    uint32 loEnd      = 0;
+    uint32 hiStart    = 0;
+    uint32 hiEnd      = 0;
+    uint32 freeBlocks = 0;
+    uint32 best       = BRICK_ALLOC_ERROR;
+
+    loStart    = brickNextFreeRun(slab, 0, &loEnd);
+    hiStart    = loStart;
+    hiEnd      = loEnd;
+    freeBlocks = loEnd - loStart;
+
+    while(loStart < slab->numBlocks) {
+        //widen the window to the right until it holds enough free blocks:
+        while((freeBlocks < need) && (hiEnd < slab->numBlocks)) {
+            hiStart     = brickNextFreeRun(slab, hiEnd, &hiEnd);
+            freeBlocks += hiEnd - hiStart;
+        }
+        if(freeBlocks < need) {
+            break;
+        }
+        if((hiEnd - loStart) - freeBlocks < best) {
+            best   = (hiEnd - loStart) - freeBlocks;
+            *first = loStart;
+            *last  = hiEnd;
+        }
+
+        //then narrow it from the left:
+        freeBlocks -= loEnd - loStart;
+        loStart     = brickNextFreeRun(slab, loEnd, &loEnd);
+        if(loStart > hiStart) {
+            hiStart    = loStart;
+            hiEnd      = loEnd;
+            freeBlocks = loEnd - loStart;
+        }
+    }
+
+    return best;
+}
+
+
+#ifdef BRICK_CONCURRENT
+//Makes the sequence counters covering blocks [first, last) odd, so brickRead retries anything under way there.
+//brickSeqBegin :: brickContext* -> uint32 -> uint32 -> Effect
+static void brickSeqBegin(brickContext* slab, uint32 first, uint32 last) {
+    uint32 r = 0;
+
+    if(!slab->seqs) {
+        return;
+    }
+    for(r = first >> slab->seqShift; r <= (last-1) >> slab->seqShift; r++) {
+        BRICK_STORE_RELEASE(&slab->seqs[r], slab->seqs[r]+1);
+    }
+
+    //the counters must be seen odd before any of the data moves:
+    BRICK_FENCE_RELEASE();
+}
+
+
+//Makes the sequence counters covering blocks [first, last) even again, publishing the move.
+//brickSeqEnd :: brickContext* -> uint32 -> uint32 -> Effect
+static void brickSeqEnd(brickContext* slab, uint32 first, uint32 last) {
+    uint32 r = 0;
+
+    if(!slab->seqs) {
+        return;
+    }
+    for(r = first >> slab->seqShift; r <= (last-1) >> slab->seqShift; r++) {
+        BRICK_STORE_RELEASE(&slab->seqs[r], slab->seqs[r]+1);
+    }
+}
+#endif //ifdef BRICK_CONCURRENT
+
+
+//Slides the allocations in [first, last) down to `first`, keeping their order, so the window's free
+//blocks end up as one run at its end. Every allocation that moves is reported to the relocation callback.
+//brickCompactSlide :: brickContext* -> brickContext* -> uint32 -> uint32 -> Effect
+static void brickCompactSlide(brickContext* ctx, brickContext* slab, uint32 first, uint32 last) {
+    uint32 dest    = first;
+    uint32 vacated = first;
+    uint32 i       = first;
+    uint32 end     = 0;
+    uint32 k       = 0;
+    char* start    = 0;
+
+#ifdef BRICK_BLOCK_STACK
+    //the allocations land on free blocks, which may be holding the stack's links:
+    brickStackReset(slab);
+#endif //ifdef BRICK_BLOCK_STACK
+
+    while(i < last) {
+        if(!slab->blockptrlist[i]) {
+            i++;
+            continue;
+        }
+        start = slab->blockptrlist[i];
+        for(end = i; (end < last) && (slab->blockptrlist[end] == start); end++) { continue; }
+
+        if(dest != i) {
+#ifdef BRICK_CONCURRENT
+            brickSeqBegin(slab, dest, end);
+#endif //ifdef BRICK_CONCURRENT
+            memmove(&slab->memory[(uint64)dest*slab->blockSize], BRICK_REF_PTR(slab, start), (uint64)(end-i)*slab->blockSize);
+            for(k = dest; k < dest+(end-i); k++) {
+                slab->blockptrlist[k] = BRICK_BLOCK_REF(slab, dest);
+            }
+            for(k = (dest+(end-i) > i) ? dest+(end-i) : i; k < end; k++) {
+                slab->blockptrlist[k] = 0;
+            }
+#ifdef BRICK_PURGE
+            if(slab->purgeMap) {
+                for(k = dest; k < dest+(end-i); k++) {
+                    BRICK_BIT_CLEAR(slab->purgeMap, k);
+                }
+            }
+#endif //ifdef BRICK_PURGE
+#ifdef BRICK_IOVEC
+            if(slab->lengths) {
+                slab->lengths[dest] = slab->lengths[i];
+            }
+#endif //ifdef BRICK_IOVEC
+            BRICK_MARK_DIRTY(slab, dest, end);
+            vacated = end;
+#ifdef BRICK_REGIONS
+            brickRegionRekey(ctx, BRICK_SLAB_KEY(slab, i), BRICK_SLAB_KEY(slab, dest));
+#endif //ifdef BRICK_REGIONS
+#ifdef BRICK_TAGS
+            brickTagMove(ctx, slab, i, dest);
+#endif //ifdef BRICK_TAGS
+            ctx->relocateFn(ctx, BRICK_SLAB_KEY(slab, i), BRICK_SLAB_KEY(slab, dest), ctx->relocateUserData);
+#ifdef BRICK_CONCURRENT
+            //the callback has stored the new key by now, so readers that see the counters settle also see it:
+            brickSeqEnd(slab, dest, end);
+#endif //ifdef BRICK_CONCURRENT
+        }
+
+        dest += end-i;
+        i     = end;
+    }
+
+#ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
+    //blocks the allocations moved out of still hold their old contents:
+    if(vacated > dest) {
+        memset(&slab->memory[(uint64)dest*slab->blockSize], '\0', (uint64)(vacated-dest)*slab->blockSize);
+    }
+#endif //ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
+    (void)vacated;
+}
+
+
+//Opens a free run of `need` blocks by moving as few allocated blocks as possible, in whichever slab
+//needs the fewest moved. Returns that slab, or 0 if no slab can do it within the context's move limit.
+//brickCompact :: brickContext* -> uint32 -> Effect -> brickContext*
+static brickContext* brickCompact(brickContext* ctx, uint32 need) {
+    brickContext* slab = ctx;
+    brickContext* best = 0;
+    uint32 bestMoved   = BRICK_ALLOC_ERROR;
+    uint32 bestFirst   = 0;
+    uint32 bestLast    = 0;
+    uint32 moved       = 0;
+    uint32 first       = 0;
+    uint32 last        = 0;
+#ifdef BRICK_TRACE
+    uint64 traceStart  = brickCycles();
+#endif //ifdef BRICK_TRACE
+
+    for(; slab; slab = BRICK_NEXT_SLAB(slab)) {
+        //buddy blocks can't be slid around without breaking their alignment:
+        if(!BRICK_FLAT(slab)) {
+            continue;
+        }
+        moved = brickCompactWindow(slab, need, &first, &last);
+        if((moved < bestMoved) && (!ctx->relocateMaxBlocks || (moved <= ctx->relocateMaxBlocks))) {
+            best      = slab;
+            bestMoved = moved;
+            bestFirst = first;
+            bestLast  = last;
+        }
+    }
+
+    if(best) {
+        brickCompactSlide(ctx, best, bestFirst, bestLast);
+#ifdef BRICK_TRACE
+        BRICK_TRACE_EVENT(ctx, gc, BRICK_OP_GC, BRICK_ALLOC_ERROR, bestMoved, brickCycles() - traceStart);
+#endif //ifdef BRICK_TRACE
+    }
+
+    return best;
+}
+
+#endif //ifdef BRICK_COMPACT
+
+
+//---------------------------------------------------------
+// FUNCTION IMPLEMENTATIONS:
+
+//Returns an unsigned integer key into the list of allocation ptrs.
+// usage: char* blockptrs[numberofblocksinlist]; uint32 key = blockalloc(size);
+//on dealloc: charptr is zeroed out.
+//on alloc: since numblocks == numblockptrs, we set all "dirty" blockptrs to point to the start of the region.
+//search for open blocks by doing a linear search of the blockptrs array.
+
+
+//Zeroes out initial memory of the pointer array, and sets the context's reference to the slab of memory.
+//brickInit :: brickContext* -> [char*] -> char* -> uint32 -> uint32 -> Effect
+void brickInit(brickContext* ctx, char** blockPtrList, char* memory, uint32 numBlocks, uint32 blockSize) {
+    uint32 i          = 0;
+    ctx->blockptrlist = blockPtrList;
+    ctx->memory       = memory;
+    ctx->numBlocks    = numBlocks;
+    ctx->blockSize    = blockSize;
+#ifdef BRICK_GROWABLE
+    //keys only have room for BRICK_BLOCK_MASK+1 blocks per slab; anything past that goes unused:
+    if(numBlocks > BRICK_BLOCK_MASK+1) {
+        ctx->numBlocks = BRICK_BLOCK_MASK+1;
+    }
+    ctx->next         = 0;
+    ctx->slabIndex    = 0;
+    ctx->usedBlocks   = 0;
+    ctx->growFn       = 0;
+    ctx->releaseFn    = 0;
+    ctx->growUserData = 0;
+#endif //ifdef BRICK_GROWABLE
+#ifdef BRICK_PURGE
+    ctx->purgeMap       = 0;
+    ctx->purgeThreshold = 0;
+    ctx->purgeAnonymous = 0;
+#endif //ifdef BRICK_PURGE
+#ifdef BRICK_CHECKPOINT
+    ctx->dirtyMap        = 0;
+    ctx->checkpointEpoch = 0;
+#endif //ifdef BRICK_CHECKPOINT
+#ifdef BRICK_IOVEC
+    ctx->lengths         = 0;
+#endif //ifdef BRICK_IOVEC
+#ifdef BRICK_BLOCK_STACK
+    brickStackReset(ctx);
+#endif //ifdef BRICK_BLOCK_STACK
+#ifdef BRICK_BUDDY
+    ctx->engine          = BRICK_ENGINE_FLAT;
+#endif //ifdef BRICK_BUDDY
+#ifdef BRICK_CONCURRENT
+    ctx->seqs              = 0;
+    ctx->seqShift          = 0;
+#endif //ifdef BRICK_CONCURRENT
+#ifdef BRICK_COMPACT
+    ctx->relocateFn        = 0;
+    ctx->relocateMaxBlocks = 0;
+    ctx->relocateUserData  = 0;
+#endif //ifdef BRICK_COMPACT
+#ifdef BRICK_REGIONS
+    ctx->regionLog      = 0;
+    ctx->regionCapacity = 0;
+    ctx->regionLength   = 0;
+    ctx->regionDepth    = 0;
+#endif //ifdef BRICK_REGIONS
+#ifdef BRICK_TAGS
+    ctx->tags     = 0;
+    ctx->numTags  = 0;
+    ctx->tagLinks = 0;
+#endif //ifdef BRICK_TAGS
+#ifdef BRICK_SHARED
+    ctx->shared   = 0;
+#endif //ifdef BRICK_SHARED
+#ifdef BRICK_WAIT
+    ctx->waitHead = 0;
+    ctx->waitTail = 0;
+    brickMutexInit(&ctx->waitLock);
+    brickCondInit(&ctx->waitCond);
+#endif //ifdef BRICK_WAIT
+#ifdef BRICK_TRACE
+    ctx->traceHook     = 0;
+    ctx->traceUserData = 0;
+#endif //ifdef BRICK_TRACE
+
+    for(; i < numBlocks; i++) {
+        ctx->blockptrlist[i] = 0;
+    }
+}
+
+
+#ifdef BRICK_BUDDY
+//Like brickInit, but picks the allocation engine the context runs: BRICK_ENGINE_FLAT (first fit) or BRICK_ENGINE_BUDDY.
+//The buddy engine needs blocks of at least 12 bytes; with smaller ones the context stays flat.
+//brickInitEngine :: brickContext* -> [char*] -> char* -> uint32 -> uint32 -> uint32 -> Effect
+void brickInitEngine(brickContext* ctx, char** blockPtrList, char* memory, uint32 numBlocks, uint32 blockSize, uint32 engine) {
+    brickInit(ctx, blockPtrList, memory, numBlocks, blockSize);
+
+    if((engine == BRICK_ENGINE_BUDDY) && (blockSize >= sizeof(brickBuddyNode))) {
+        ctx->engine = BRICK_ENGINE_BUDDY;
+        brickBuddyRebuild(ctx);
+    }
+}
+#endif //ifdef BRICK_BUDDY
+
+
+//Returns the starting index/key of the first fit for an allocation of length `length`.
+//Returns 0 on failure, 1+ on success. (thus, our indexes start at 1, much like in Lua.)
+//brickFindOpenRun :: brickContext* -> uint32 -> uint32
+uint32 brickFindOpenRun(brickContext* ctx, uint32 length) {
+    uint32 i          = 0;
+    uint32 currentRun = 0;
+
+    for(; i < ctx->numBlocks; i++) {
+        if(ctx->blockptrlist[i] == 0) {
+            currentRun++;
+            if(currentRun == length) {
+                i -= (currentRun-1);
+                return i+1; //start indexes at 1+
+            }
+            continue;
+        }
+        //Implicit else:
+        currentRun = 0;
+    }
+
+    //no run long enough was found:
+    return 0;
+}
+
+
+//brickSlabTake flags: zero the memory handed out, and/or the block came off the free stack.
+#define BRICK_TAKE_ZERO   0x1
+#define BRICK_TAKE_POPPED 0x2
+
+
+//Writes the pointers for an allocation of the free blocks [block, block+blocks) in a single slab,
+//zeroing its memory if BRICK_TAKE_ZERO is set.
+//brickSlabTake :: brickContext* -> uint32 -> uint32 -> uint32 -> Effect
+static void brickSlabTake(brickContext* slab, uint32 block, uint32 blocks, uint32 flags) {
+    uint32 i    = 0;
+    uint32 zero = flags & BRICK_TAKE_ZERO;
+
+#ifdef BRICK_BLOCK_STACK
+    //stacked blocks keep their links in their memory, so they must never be handed out
+    //any other way. Drop the stack if this run might contain one of them:
+    if(!(flags & BRICK_TAKE_POPPED) && (block <= slab->stackHigh) && (block+blocks > slab->stackLow)) {
+        brickStackReset(slab);
+    }
+#endif //ifdef BRICK_BLOCK_STACK
+
+    for(i = block; i < block+blocks; i++) {
+        slab->blockptrlist[i] = BRICK_BLOCK_REF(slab, block);
+    }
+
+#ifdef BRICK_PURGE
+    //purged anonymous blocks are handed out already zeroed; everything else may need a memset:
+    if(slab->purgeMap) {
+        for(i = block; i < block+blocks; i++) {
+            if(BRICK_BIT_TEST(slab->purgeMap, i)) {
+                BRICK_BIT_CLEAR(slab->purgeMap, i);
+                if(zero && !slab->purgeAnonymous) {
+                    memset(&slab->memory[i*slab->blockSize], '\0', slab->blockSize);
+                }
+            } else if(zero) {
+                memset(&slab->memory[i*slab->blockSize], '\0', slab->blockSize);
+            }
+        }
+        zero = 0;
+    }
+#endif //ifdef BRICK_PURGE
+
+    if(zero) {
+        memset(&slab->memory[block*slab->blockSize], '\0', blocks*slab->blockSize);
+    }
+
+#ifdef BRICK_GROWABLE
+    slab->usedBlocks += blocks;
+#endif //ifdef BRICK_GROWABLE
+
+#ifdef BRICK_IOVEC
+    if(slab->lengths) {
+        slab->lengths[block] = blocks*slab->blockSize;
+    }
+#endif //ifdef BRICK_IOVEC
+
+    BRICK_MARK_DIRTY(slab, block, block+blocks);
+}
+
+
+//Finds room for and takes an allocation of `blocksNeeded` blocks in a single slab.
+//Returns the block index of the allocation, or BRICK_ALLOC_ERROR if the slab has no room.
+//brickSlabMalloc :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+static uint32 brickSlabMalloc(brickContext* slab, uint32 blocksNeeded, uint32 zero) {
+    uint32 block = 0;
+
+#ifdef BRICK_BUDDY
+    if(slab->engine == BRICK_ENGINE_BUDDY) {
+        uint32 order = brickBuddyOrder(blocksNeeded);
+
+        block = blocksNeeded ? brickBuddyCarve(slab, order) : BRICK_ALLOC_ERROR;
+        if(block != BRICK_ALLOC_ERROR) {
+            brickSlabTake(slab, block, 1u << order, zero);
+        }
+        return block;
+    }
+#endif //ifdef BRICK_BUDDY
+
+#ifdef BRICK_BLOCK_STACK
+    //single blocks come off the free stack when there are any:
+    if(blocksNeeded == 1) {
+        block = brickStackPop(slab);
+        if(block != BRICK_ALLOC_ERROR) {
+            brickSlabTake(slab, block, 1, zero | BRICK_TAKE_POPPED);
+            return block;
+        }
+    }
+#endif //ifdef BRICK_BLOCK_STACK
+
+    block = brickFindOpenRun(slab, blocksNeeded);
+
+    //allocation failure case:
+    if(!block) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    //subtract 1 to obtain true start index location, and write pointers:
+    block -= 1;
+    brickSlabTake(slab, block, blocksNeeded, zero);
+
+    return block;
+}
+
+
+//Clears the pointers of the allocation starting at `block` in a single slab.
+//Returns the number of blocks that were freed.
+//brickSlabFree :: brickContext* -> uint32 -> Effect -> uint32
+static uint32 brickSlabFree(brickContext* slab, uint32 block) {
+    uint32 i     = block;
+    char* keyval = slab->blockptrlist[block];
+
+    //determine number of blocks in the allocation, accumulating the count in `i`:
+    for(; (i < slab->numBlocks) && (slab->blockptrlist[i] == keyval); i++) { continue; }
+
+#ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
+    //zero-write over the blocks:
+    memset(BRICK_REF_PTR(slab, keyval), '\0', (uint64)(i-block)*slab->blockSize);
+#endif //ifdef BRICK_ZERO_WRITE_DEST_BLOCKS
+
+    memset(&slab->blockptrlist[block], 0, (i-block)*sizeof(char*));
+    BRICK_MARK_DIRTY(slab, block, i);
+
+#ifdef BRICK_BUDDY
+    if(!BRICK_FLAT(slab)) {
+        brickBuddyRelease(slab, block, i-block);
+    }
+#endif //ifdef BRICK_BUDDY
+
+#if defined(BRICK_BLOCK_STACK) && !defined(BRICK_ZERO_WRITE_DEST_BLOCKS)
+    //(the stack's links would undo the zero-write, so under it freed blocks are found by scanning again)
+    if((i-block == 1) && BRICK_FLAT(slab)) {
+        brickStackPush(slab, block);
+    }
+#endif //if defined(BRICK_BLOCK_STACK) && !defined(BRICK_ZERO_WRITE_DEST_BLOCKS)
+
+#ifdef BRICK_PURGE
+    //big frees purge the whole free run around them right away:
+    if(slab->purgeMap && slab->purgeThreshold && BRICK_FLAT(slab) && ((uint64)(i-block)*slab->blockSize >= slab->purgeThreshold)) {
+        uint32 first = block;
+        uint32 last  = i;
+        while((first > 0) && (slab->blockptrlist[first-1] == 0)) { first--; }
+        while((last < slab->numBlocks) && (slab->blockptrlist[last] == 0)) { last++; }
+        brickPurgeRange(slab, first, last);
+    }
+#endif //ifdef BRICK_PURGE
+
+#ifdef BRICK_GROWABLE
+    slab->usedBlocks -= (i-block);
+#endif //ifdef BRICK_GROWABLE
+
+    return i-block;
+}
+
+
+#ifdef BRICK_GROWABLE
+//Finds the slab a key points into. Returns 0 if no such slab is chained in.
+//brickKeySlab :: brickContext* -> uint32 -> brickContext*
+static brickContext* brickKeySlab(brickContext* ctx, uint32 key) {
+    brickContext* slab = ctx;
+    uint32 slabIndex   = BRICK_KEY_SLAB(key);
+
+    while(slab && (slab->slabIndex != slabIndex)) {
+        slab = slab->next;
+    }
+
+    return slab;
+}
+
+
+//Asks the growth callback for a slab with room for at least `minBlocks` blocks, and chains it in.
+//Returns the new slab, or 0 if none could be had.
+//brickGrow :: brickContext* -> uint32 -> Effect -> brickContext*
+static brickContext* brickGrow(brickContext* ctx, uint32 minBlocks) {
+    brickContext* tail = ctx;
+    brickContext* slab = 0;
+
+    while(tail->next) {
+        tail = tail->next;
+    }
+
+    if(!ctx->growFn || (tail->slabIndex+1 >= BRICK_MAX_SLABS)) {
+        return 0;
+    }
+
+    slab = ctx->growFn(ctx, minBlocks, ctx->growUserData);
+    if(!slab) {
+        return 0;
+    }
+
+    //a slab we can't address (or can't use) goes straight back:
+    if((slab->blockSize != ctx->blockSize) || (slab->numBlocks > BRICK_BLOCK_MASK+1) || (slab->numBlocks < minBlocks)) {
+        if(ctx->releaseFn) {
+            ctx->releaseFn(ctx, slab, ctx->growUserData);
+        }
+        return 0;
+    }
+
+    slab->next      = 0;
+    slab->slabIndex = tail->slabIndex+1;
+    tail->next      = slab;
+
+#ifdef BRICK_BUDDY
+    //chained slabs run the same engine as the head:
+    if(ctx->engine != slab->engine) {
+        slab->engine = ctx->engine;
+        brickBuddyRebuild(slab);
+    }
+#endif //ifdef BRICK_BUDDY
+
+    return slab;
+}
+
+
+//Hands empty slabs at the end of the chain back to the release callback.
+//The head context itself is never released.
+//brickShrink :: brickContext* -> Effect
+static void brickShrink(brickContext* ctx) {
+    brickContext* prev = 0;
+    brickContext* tail = 0;
+
+    while(ctx->releaseFn) {
+        prev = ctx;
+        tail = ctx->next;
+        if(!tail) {
+            return;
+        }
+        while(tail->next) {
+            prev = tail;
+            tail = tail->next;
+        }
+        if(tail->usedBlocks) {
+            return;
+        }
+        prev->next = 0;
+        ctx->releaseFn(ctx, tail, ctx->growUserData);
+    }
+}
+#endif //ifdef BRICK_GROWABLE
+
+
+//Finds the slab a key points into, and the key's block index within it.
+//Returns 0 if no such slab is chained in.
+//brickResolve :: brickContext* -> uint32 -> uint32* -> brickContext*
+static brickContext* brickResolve(brickContext* ctx, uint32 key, uint32* block) {
+#ifdef BRICK_GROWABLE
+    *block = BRICK_KEY_BLOCK(key);
+    return brickKeySlab(ctx, key);
+#else
+    *block = key;
+    return ctx;
+#endif //ifdef BRICK_GROWABLE
+}
+
+
+//Shared body of brickMalloc and brickCalloc.
+//brickAlloc :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+static uint32 brickAlloc(brickContext* ctx, uint32 size, uint32 zero) {
+    uint32 key          = 0;
+    uint32 blocksNeeded = 1;
+    brickContext* slab  = ctx;
+#ifdef BRICK_TRACE
+    uint64 traceStart   = brickCycles();
+    uint64 traceCycles  = 0;
+#endif //ifdef BRICK_TRACE
+
+    //one-block requests (the common case for object pools) skip the rounding:
+    if(!size || (size > ctx->blockSize)) {
+        blocksNeeded = swedeRoundUp(size, ctx->blockSize) / ctx->blockSize;
+    }
+
+#ifdef BRICK_SHARED
+    brickSharedLock(ctx);
+#endif //ifdef BRICK_SHARED
+    key = brickSlabMalloc(slab, blocksNeeded, zero);
+
+#ifdef BRICK_GROWABLE
+    //try every chained slab, then ask for a new one:
+    while((key == BRICK_ALLOC_ERROR) && slab->next) {
+        slab = slab->next;
+        key  = brickSlabMalloc(slab, blocksNeeded, zero);
+    }
+    if((key == BRICK_ALLOC_ERROR) && blocksNeeded) {
+#ifdef BRICK_BUDDY
+        //a buddy slab has to fit the rounded-up block:
+        slab = brickGrow(ctx, BRICK_FLAT(ctx) ? blocksNeeded : (1u << brickBuddyOrder(blocksNeeded)));
+#else
+        slab = brickGrow(ctx, blocksNeeded);
+#endif //ifdef BRICK_BUDDY
+        if(slab) {
+            key = brickSlabMalloc(slab, blocksNeeded, zero);
+        }
+    }
+#endif //ifdef BRICK_GROWABLE
+
+#ifdef BRICK_COMPACT
+    //last resort: move a few allocations out of the way:
+    if((key == BRICK_ALLOC_ERROR) && blocksNeeded && ctx->relocateFn) {
+        slab = brickCompact(ctx, blocksNeeded);
+        if(slab) {
+            key = brickSlabMalloc(slab, blocksNeeded, zero);
+        }
+    }
+#endif //ifdef BRICK_COMPACT
+
+    if(key != BRICK_ALLOC_ERROR) {
+#ifdef BRICK_IOVEC
+        if(slab->lengths) {
+            slab->lengths[key] = size;
+        }
+#endif //ifdef BRICK_IOVEC
+        key = BRICK_SLAB_KEY(slab, key);
+    }
+#ifdef BRICK_SHARED
+    brickSharedUnlock(ctx);
+#endif //ifdef BRICK_SHARED
+
+#ifdef BRICK_TRACE
+    traceCycles = brickCycles() - traceStart;
+    BRICK_TRACE_EVENT(ctx, malloc, BRICK_OP_MALLOC, key, blocksNeeded, traceCycles);
+#endif //ifdef BRICK_TRACE
+    return key;
+}
+
+
+#ifdef BRICK_WAIT
+//Serves queued requests oldest first, for as long as they fit.
+//brickServeWaiters :: brickContext* -> Effect
+static void brickServeWaiters(brickContext* ctx) {
+    brickWaiter* waiter = 0;
+    uint32 key          = 0;
+
+    while((waiter = ctx->waitHead)) {
+        key = brickAlloc(ctx, waiter->size, 0);
+        if(key == BRICK_ALLOC_ERROR) {
+            return;
+        }
+
+        //dequeue before the callback, which may free (and so serve) in turn:
+        ctx->waitHead = waiter->next;
+        if(!ctx->waitHead) {
+            ctx->waitTail = 0;
+        }
+        waiter->next = 0;
+        waiter->key  = key;
+        if(waiter->fn) {
+            waiter->fn(ctx, waiter, key, waiter->userData);
+        }
+    }
+}
+
+
+//Serves queued requests after the blocks at `block` in `slab` were freed. The oldest waiter already
+//failed to fit, so nothing is tried unless the free run around `block` is now long enough for it
+//(or, when compaction could gather one, the slab as a whole has enough free blocks).
+//brickWakeWaiters :: brickContext* -> brickContext* -> uint32 -> Effect
+static void brickWakeWaiters(brickContext* ctx, brickContext* slab, uint32 block) {
+    uint32 first      = block;
+    uint32 last       = block;
+#ifdef BRICK_COMPACT
+    uint32 freeBlocks = 0;
+    uint32 i          = 0;
+#endif //ifdef BRICK_COMPACT
+
+    while((first > 0) && !slab->blockptrlist[first-1]) {
+        first--;
+    }
+    while((last < slab->numBlocks) && !slab->blockptrlist[last]) {
+        last++;
+    }
+
+    if(last-first >= ctx->waitHead->blocks) {
+        brickServeWaiters(ctx);
+        return;
+    }
+
+#ifdef BRICK_COMPACT
+    //compaction can gather a run out of free blocks anywhere in the slab:
+    if(ctx->relocateFn) {
+        for(; i < slab->numBlocks; i++) {
+            freeBlocks += !slab->blockptrlist[i];
+        }
+        if(freeBlocks >= ctx->waitHead->blocks) {
+            brickServeWaiters(ctx);
+        }
+    }
+#endif //ifdef BRICK_COMPACT
+}
+
+
+//Returns the most blocks one allocation from `slab` can ever span: all of them for the flat engine,
+//the largest power of two that fits for the buddy engine (its blocks are aligned, and never straddle two top-level blocks).
+//brickSlabLimit :: brickContext* -> uint32
+static uint32 brickSlabLimit(brickContext* slab) {
+    uint32 limit = slab->numBlocks;
+
+    if(!BRICK_FLAT(slab)) {
+        while(limit & (limit-1)) {
+            limit &= limit-1;
+        }
+    }
+
+    return limit;
+}
+
+
+//Gives queued requests first go at the free space before a direct allocation.
+//Returns nonzero if some are still queued, in which case the direct allocation must not jump the queue.
+//brickWaitersAhead :: brickContext* -> Effect -> uint32
+static uint32 brickWaitersAhead(brickContext* ctx) {
+    if(ctx->waitHead) {
+        brickServeWaiters(ctx);
+    }
+
+    return ctx->waitHead != 0;
+}
+#endif //ifdef BRICK_WAIT
+
+
+#ifdef BRICK_REGIONS
+//Allocates like brickAlloc, and records the key in the region log so releasing the innermost mark frees it.
+//brickRegionAlloc :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+static uint32 brickRegionAlloc(brickContext* ctx, uint32 size, uint32 zero) {
+    uint32 key = 0;
+
+    //refuse, rather than hand out an allocation no release would free:
+    if(ctx->regionLength == ctx->regionCapacity) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    key = brickAlloc(ctx, size, zero);
+    if(key != BRICK_ALLOC_ERROR) {
+        ctx->regionLog[ctx->regionLength++] = key;
+    }
+
+    return key;
+}
+#endif //ifdef BRICK_REGIONS
+
+
+//Returns a key for later access into the index.
+//Returns BRICK_ALLOC_ERROR on failure.
+//blockMalloc :: brickContext -> uint32 -> Effect -> uint32
+uint32 brickMalloc(brickContext* ctx, uint32 size) {
+#ifdef BRICK_WAIT
+    if(brickWaitersAhead(ctx)) {
+        return BRICK_ALLOC_ERROR;
+    }
+#endif //ifdef BRICK_WAIT
+#ifdef BRICK_REGIONS
+    if(ctx->regionDepth) {
+        return brickRegionAlloc(ctx, size, 0);
+    }
+#endif //ifdef BRICK_REGIONS
+    return brickAlloc(ctx, size, 0);
+}
+
+
+//Like brickMalloc, but the allocated memory is zeroed out.
+//brickCalloc :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickCalloc(brickContext* ctx, uint32 size) {
+#ifdef BRICK_WAIT
+    if(brickWaitersAhead(ctx)) {
+        return BRICK_ALLOC_ERROR;
+    }
+#endif //ifdef BRICK_WAIT
+#ifdef BRICK_REGIONS
+    if(ctx->regionDepth) {
+        return brickRegionAlloc(ctx, size, 1);
+    }
+#endif //ifdef BRICK_REGIONS
+    return brickAlloc(ctx, size, 1);
+}
+
+
+//"Frees" memory by zeroing out the pointers in the pointer array.
+//NOTE: if BRICK_ZERO_WRITE_DEST_BLOCKS is set, then the blocks of memory will also be zeroed out.
+//blockFree :: brickContext* -> uint32 -> Effect
+void brickFree(brickContext* ctx, uint32 key) {
+    uint32 block       = 0;
+    uint32 freed       = 0;
+    brickContext* slab = brickResolve(ctx, key, &block);
+#ifdef BRICK_TRACE
+    uint64 traceStart  = brickCycles();
+#endif //ifdef BRICK_TRACE
+
+    if(!slab) {
+        return;
+    }
+#ifdef BRICK_TAGS
+    if(slab->tagLinks && slab->blockptrlist[block] && (slab->tagLinks[block].tag != BRICK_TAG_NONE)) {
+        brickTagUnlink(ctx, &slab->tagLinks[block]);
+    }
+#endif //ifdef BRICK_TAGS
+#ifdef BRICK_SHARED
+    brickSharedLock(ctx);
+    freed = brickSlabFree(slab, block);
+    brickSharedUnlock(ctx);
+#else
+    freed = brickSlabFree(slab, block);
+#endif //ifdef BRICK_SHARED
+
+#ifdef BRICK_WAIT
+    //before shrinking, so a waiter can still have the slab:
+    if(ctx->waitHead && freed) {
+        brickWakeWaiters(ctx, slab, block);
+    }
+#endif //ifdef BRICK_WAIT
+
+#ifdef BRICK_GROWABLE
+    if(!slab->usedBlocks && !slab->next) {
+        brickShrink(ctx);
+    }
+#endif //ifdef BRICK_GROWABLE
+
+#ifdef BRICK_TRACE
+    BRICK_TRACE_EVENT(ctx, free, BRICK_OP_FREE, key, freed, brickCycles() - traceStart);
+#endif //ifdef BRICK_TRACE
+    (void)freed;
+}
+
+
+//Returns the pointer to the start of the allocation a key refers to (0 if it is free).
+//brickGetPtr :: brickContext* -> uint32 -> char*
+char* brickGetPtr(brickContext* ctx, uint32 key) {
+    uint32 block       = 0;
+    brickContext* slab = brickResolve(ctx, key, &block);
+
+    return (slab && slab->blockptrlist[block]) ? BRICK_REF_PTR(slab, slab->blockptrlist[block]) : 0;
+}
+
+
+//A full, stop-the-world compaction of the blocklist.
+//CONCURRENCY NOTE: Needs to be wrapped in a mutex or critical section for safe use.
+//brickGC :: brickContext* -> Effect
+void brickGC(brickContext* ctx) {
+#ifdef BRICK_TRACE
+    uint64 traceStart = brickCycles();
+
+    BRICK_TRACE_EVENT(ctx, gc, BRICK_OP_GC, BRICK_ALLOC_ERROR, 0, brickCycles() - traceStart);
+#endif //ifdef BRICK_TRACE
+}
+
+
+#ifdef BRICK_GROWABLE
+//Sets the callbacks used to chain in a new slab when `ctx` runs out of room, and to give back empty ones.
+//brickSetGrowth :: brickContext* -> brickGrowFn -> brickReleaseFn -> void* -> Effect
+void brickSetGrowth(brickContext* ctx, brickGrowFn grow, brickReleaseFn release, void* userData) {
+    ctx->growFn       = grow;
+    ctx->releaseFn    = release;
+    ctx->growUserData = userData;
+}
+#endif //ifdef BRICK_GROWABLE
+
+
+#ifdef BRICK_SCATTER
+//Allocates at least `size` bytes as up to `maxSegments` separate runs, filling in `sg` (which
+//keeps using the caller's `segments` array). A single contiguous run is always tried first, just like
+//brickMalloc: with BRICK_COMPACT and a relocation callback, that try may move (and rekey) other allocations.
+//Returns the number of segments used, or BRICK_ALLOC_ERROR on failure (nothing stays allocated).
+//brickMallocScatter :: brickContext* -> uint32 -> brickScatter* -> [brickSegment] -> uint32 -> Effect -> uint32
+uint32 brickMallocScatter(brickContext* ctx, uint32 size, brickScatter* sg, brickSegment* segments, uint32 maxSegments) {
+    uint32 blocksLeft  = swedeRoundUp(size, ctx->blockSize) / ctx->blockSize;
+    uint32 key         = 0;
+    uint32 i           = 0;
+    uint32 runStart    = 0;
+    brickContext* slab = ctx;
+
+    sg->segments    = segments;
+    sg->maxSegments = maxSegments;
+    sg->numSegments = 0;
+    sg->size        = size;
+
+    if(!blocksLeft || !maxSegments) {
+        return BRICK_ALLOC_ERROR;
+    }
+#ifdef BRICK_WAIT
+    if(brickWaitersAhead(ctx)) {
+        return BRICK_ALLOC_ERROR;
+    }
+#endif //ifdef BRICK_WAIT
+
+    //straight to brickAlloc: scatter allocations are never recorded in a region.
+    key = brickAlloc(ctx, size, 0);
+    if(key != BRICK_ALLOC_ERROR) {
+        segments[0].key    = key;
+        segments[0].blocks = blocksLeft;
+        sg->numSegments    = 1;
+        return 1;
+    }
+
+    //gather free runs in address order, taking only what is still needed from the last one:
+#ifdef BRICK_SHARED
+    brickSharedLock(ctx);
+#endif //ifdef BRICK_SHARED
+    for(; slab && blocksLeft && (sg->numSegments < maxSegments); slab = BRICK_NEXT_SLAB(slab)) {
+        //buddy slabs only hand out whole buddy blocks:
+        i = BRICK_FLAT(slab) ? 0 : slab->numBlocks;
+        while((i < slab->numBlocks) && blocksLeft) {
+            if(slab->blockptrlist[i] != 0) {
+                i++;
+                continue;
+            }
+            if(sg->numSegments == maxSegments) {
+                break;
+            }
+            for(runStart = i; (i < slab->numBlocks) && (slab->blockptrlist[i] == 0) && (i-runStart < blocksLeft); i++) { continue; }
+
+            brickSlabTake(slab, runStart, i-runStart, 0);
+            segments[sg->numSegments].key    = BRICK_SLAB_KEY(slab, runStart);
+            segments[sg->numSegments].blocks = i-runStart;
+            sg->numSegments++;
+            blocksLeft -= i-runStart;
+        }
+    }
+
+#ifdef BRICK_SHARED
+    brickSharedUnlock(ctx);
+#endif //ifdef BRICK_SHARED
+
+    if(!blocksLeft) {
+#ifdef BRICK_IOVEC
+        //only the last segment can be partly used:
+        slab = brickResolve(ctx, segments[sg->numSegments-1].key, &runStart);
+        if(slab->lengths) {
+            slab->lengths[runStart] -= swedeRoundUp(size, ctx->blockSize) - size;
+        }
+#endif //ifdef BRICK_IOVEC
+        return sg->numSegments;
+    }
+
+    brickFreeScatter(ctx, sg);
+    return BRICK_ALLOC_ERROR;
+}
+
+
+//Translates a byte offset into a scatter allocation to a pointer. If `contiguous` is not null, it receives
+//the number of bytes that can be accessed from that pointer before the next segment (or the end of `size`).
+//Returns 0 for offsets at or past `sg->size`, even where the last segment's padding would still fit them.
+//brickScatterPtr :: brickContext* -> brickScatter* -> uint32 -> uint32* -> char*
+char* brickScatterPtr(brickContext* ctx, brickScatter* sg, uint32 offset, uint32* contiguous) {
+    uint32 i      = 0;
+    uint32 length = 0;
+    uint32 left   = 0;
+
+    if(offset >= sg->size) {
+        return 0;
+    }
+    left = sg->size - offset;
+
+    for(; i < sg->numSegments; i++) {
+        length = sg->segments[i].blocks * ctx->blockSize;
+        if(offset < length) {
+            if(contiguous) {
+                *contiguous = (length - offset < left) ? length - offset : left;
+            }
+            return brickGetPtr(ctx, sg->segments[i].key) + offset;
+        }
+        offset -= length;
+    }
+
+    return 0;
+}
+
+
+//Frees every segment of a scatter allocation.
+//brickFreeScatter :: brickContext* -> brickScatter* -> Effect
+void brickFreeScatter(brickContext* ctx, brickScatter* sg) {
+    uint32 i = 0;
+
+    for(; i < sg->numSegments; i++) {
+        brickFree(ctx, sg->segments[i].key);
+    }
+
+    sg->numSegments = 0;
+}
+#endif //ifdef BRICK_SCATTER
+
+
+#ifdef BRICK_IOVEC
+//Returns the byte length of the allocation starting at `block` in a single slab: the recorded
+//length if the slab keeps them, otherwise every block it spans.
+//brickSlabLength :: brickContext* -> uint32 -> uint32
+static uint32 brickSlabLength(brickContext* slab, uint32 block) {
+    uint32 i = block;
+
+    if(slab->lengths) {
+        return slab->lengths[block];
+    }
+
+    for(; (i < slab->numBlocks) && (slab->blockptrlist[i] == slab->blockptrlist[block]); i++) { continue; }
+
+    return (i-block)*slab->blockSize;
+}
+
+
+//Attaches a length array (one uint32 per block) to `ctx`, so allocations remember their size in bytes.
+//Allocations that already exist are recorded as spanning all of their blocks.
+//brickLengthsAttach :: brickContext* -> [uint32] -> Effect
+void brickLengthsAttach(brickContext* ctx, uint32* lengths) {
+    uint32 i = 0;
+
+    ctx->lengths = 0;
+    for(; i < ctx->numBlocks; i++) {
+        lengths[i] = 0;
+        if(ctx->blockptrlist[i] && ((i == 0) || (ctx->blockptrlist[i-1] != ctx->blockptrlist[i]))) {
+            lengths[i] = brickSlabLength(ctx, i);
+        }
+    }
+    ctx->lengths = lengths;
+}
+
+
+//Returns the length in bytes of the allocation at `key`: its recorded length if there is one,
+//otherwise every block it spans.
+//brickLength :: brickContext* -> uint32 -> uint32
+uint32 brickLength(brickContext* ctx, uint32 key) {
+    uint32 block       = 0;
+    brickContext* slab = brickResolve(ctx, key, &block);
+
+    return (slab && slab->blockptrlist[block]) ? brickSlabLength(slab, block) : 0;
+}
+
+
+//Fills up to `*iovcnt` iovecs with the bytes of the `n` allocations in `keys`, in order, merging
+//allocations that sit back to back in memory. `*iovcnt` receives the number of iovecs used.
+//Returns the number of keys exported: less than `n` if the iovecs ran out or a key was free.
+//brickToIovec :: brickContext* -> [uint32] -> uint32 -> [iovec] -> uint32* -> uint32
+uint32 brickToIovec(brickContext* ctx, const uint32* keys, uint32 n, struct iovec* iov, uint32* iovcnt) {
+    uint32 capacity    = *iovcnt;
+    uint32 used        = 0;
+    uint32 block       = 0;
+    uint32 length      = 0;
+    uint32 i           = 0;
+    char* p            = 0;
+    brickContext* slab = 0;
+
+    for(; i < n; i++) {
+        slab = brickResolve(ctx, keys[i], &block);
+        if(!slab || !slab->blockptrlist[block]) {
+            break;
+        }
+        p      = BRICK_REF_PTR(slab, slab->blockptrlist[block]);
+        length = brickSlabLength(slab, block);
+
+        //physically contiguous with the previous iovec (which was not trimmed short):
+        if(used && ((char*)iov[used-1].iov_base + iov[used-1].iov_len == p)) {
+            iov[used-1].iov_len += length;
+            continue;
+        }
+        if(used == capacity) {
+            break;
+        }
+        iov[used].iov_base = p;
+        iov[used].iov_len  = length;
+        used++;
+    }
+
+    *iovcnt = used;
+    return i;
+}
+#endif //ifdef BRICK_IOVEC
+
+
+#ifdef BRICK_PURGE
+//Attaches a purge map (BRICK_PURGE_MAP_WORDS(numBlocks) words) to `ctx`. If `thresholdBytes` is
+//nonzero, any brickFree of at least that many bytes also purges the free run around it.
+//Set `anonymous` only if the slab is private anonymous memory: its purged pages read back as zeros, so
+//brickCalloc() can skip them. Purged pages of a file mapping read back as the file, and are memset as usual.
+//brickPurgeAttach :: brickContext* -> [uint32] -> uint32 -> uint32 -> Effect
+void brickPurgeAttach(brickContext* ctx, uint32* purgeMap, uint32 thresholdBytes, uint32 anonymous) {
+    ctx->purgeMap       = purgeMap;
+    ctx->purgeThreshold = thresholdBytes;
+    ctx->purgeAnonymous = anonymous;
+
+    memset(purgeMap, 0, BRICK_PURGE_MAP_WORDS(ctx->numBlocks)*sizeof(uint32));
+}
+
+
+//Gives the whole pages inside every free run of at least `minBytes` back to the OS.
+//Returns the number of bytes released.
+//brickPurge :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickPurge(brickContext* ctx, uint32 minBytes) {
+    uint32 released    = 0;
+    brickContext* slab = ctx;
+
+    for(; slab; slab = BRICK_NEXT_SLAB(slab)) {
+        released += brickPurgeSlab(slab, minBytes);
+    }
+
+    return released;
+}
+#endif //ifdef BRICK_PURGE
+
+
+#ifdef BRICK_CHECKPOINT
+//Attaches a dirty map (BRICK_DIRTY_MAP_WORDS(numBlocks) words) to `ctx`. Every block starts
+//out dirty, so the first checkpoint taken is a full base image.
+//brickCheckpointAttach :: brickContext* -> [uint32] -> Effect
+void brickCheckpointAttach(brickContext* ctx, uint32* dirtyMap) {
+    ctx->dirtyMap        = dirtyMap;
+    ctx->checkpointEpoch = 0;
+
+    memset(dirtyMap, 0xFF, BRICK_DIRTY_MAP_WORDS(ctx->numBlocks)*sizeof(uint32));
+}
+
+
+//Flags every block of the allocation at `key` as changed, so the next checkpoint writes it out.
+//brickMarkDirty :: brickContext* -> uint32 -> Effect
+void brickMarkDirty(brickContext* ctx, uint32 key) {
+    uint32 block       = 0;
+    uint32 i           = 0;
+    brickContext* slab = brickResolve(ctx, key, &block);
+
+    if(!slab) {
+        return;
+    }
+
+    for(i = block; (i < slab->numBlocks) && (slab->blockptrlist[i] == slab->blockptrlist[block]); i++) { continue; }
+
+    BRICK_MARK_DIRTY(slab, block, i);
+}
+
+
+//Writes every block changed since the last checkpoint (with its metadata) to `fd`, and starts a new epoch.
+//Only the head slab is covered: with BRICK_GROWABLE, a context that has chained slabs in is refused.
+//Returns the number of blocks written, or BRICK_ALLOC_ERROR if a write failed or slabs are chained in.
+//brickCheckpoint :: brickContext* -> int -> Effect -> uint32
+uint32 brickCheckpoint(brickContext* ctx, int fd) {
+    brickCheckpointHeader header;
+    uint32 i       = 0;
+    uint32 last    = 0;
+    uint32 written = 0;
+
+    if(!ctx->dirtyMap) {
+        return BRICK_ALLOC_ERROR;
+    }
+#ifdef BRICK_GROWABLE
+    //an image of the head alone would silently drop every chained slab's allocations:
+    if(ctx->next) {
+        return BRICK_ALLOC_ERROR;
+    }
+#endif //ifdef BRICK_GROWABLE
+
+    header.magic     = BRICK_CHECKPOINT_MAGIC;
+    header.epoch     = ctx->checkpointEpoch;
+    header.numBlocks = ctx->numBlocks;
+    header.blockSize = ctx->blockSize;
+    header.numRuns   = 0;
+
+    //count the runs up front, so a reader knows where this checkpoint ends:
+    for(i = 0; (last = brickNextDirtyRun(ctx, &i)); i = last) {
+        header.numRuns++;
+    }
+
+    if(!brickWriteAll(fd, &header, sizeof(header))) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    for(i = 0; (last = brickNextDirtyRun(ctx, &i)); i = last) {
+        if(!brickCheckpointRunOut(ctx, fd, i, last)) {
+            return BRICK_ALLOC_ERROR;
+        }
+        written += last - i;
+    }
+
+    memset(ctx->dirtyMap, 0, BRICK_DIRTY_MAP_WORDS(ctx->numBlocks)*sizeof(uint32));
+    ctx->checkpointEpoch++;
+
+    return written;
+}
+
+
+//Replays checkpoints from `fd` (a base image, then any deltas after it) into `ctx` until end of file.
+//`ctx` must already be brickInit'ed with the same block count and size as the checkpointed context.
+//Lengths (BRICK_IOVEC) are not checkpointed: every restored allocation is recorded as spanning all of its blocks.
+//With BRICK_GROWABLE, `ctx` must not have slabs chained in (their keys would outlive the restore).
+//Returns the number of checkpoints applied, or BRICK_ALLOC_ERROR on malformed or truncated input.
+//brickRestore :: brickContext* -> int -> Effect -> uint32
+uint32 brickRestore(brickContext* ctx, int fd) {
+    brickCheckpointHeader header;
+    uint32 applied = 0;
+    uint32 i       = 0;
+
+#ifdef BRICK_GROWABLE
+    if(ctx->next) {
+        return BRICK_ALLOC_ERROR;
+    }
+#endif //ifdef BRICK_GROWABLE
+
+    while(brickReadAll(fd, &header, sizeof(header))) {
+        if((header.magic != BRICK_CHECKPOINT_MAGIC) || (header.numBlocks != ctx->numBlocks) || (header.blockSize != ctx->blockSize)) {
+            return BRICK_ALLOC_ERROR;
+        }
+        for(i = 0; i < header.numRuns; i++) {
+            if(!brickRestoreRun(ctx, fd)) {
+                return BRICK_ALLOC_ERROR;
+            }
+        }
+        ctx->checkpointEpoch = header.epoch + 1;
+        applied++;
+    }
+
+#ifdef BRICK_GROWABLE
+    ctx->usedBlocks = 0;
+    for(i = 0; i < ctx->numBlocks; i++) {
+        ctx->usedBlocks += (ctx->blockptrlist[i] != 0);
+    }
+#endif //ifdef BRICK_GROWABLE
+
+#ifdef BRICK_BLOCK_STACK
+    //restored memory no longer holds the stack's links:
+    brickStackReset(ctx);
+#endif //ifdef BRICK_BLOCK_STACK
+#ifdef BRICK_BUDDY
+    if(!BRICK_FLAT(ctx)) {
+        brickBuddyRebuild(ctx);
+    }
+#endif //ifdef BRICK_BUDDY
+
+#ifdef BRICK_IOVEC
+    //lengths are not checkpointed; restored allocations are recorded as spanning all of their blocks:
+    if(ctx->lengths) {
+        brickLengthsAttach(ctx, ctx->lengths);
+    }
+#endif //ifdef BRICK_IOVEC
+
+    //what we just restored matches what is on disk:
+    if(ctx->dirtyMap) {
+        memset(ctx->dirtyMap, 0, BRICK_DIRTY_MAP_WORDS(ctx->numBlocks)*sizeof(uint32));
+    }
+
+    return applied;
+}
+#endif //ifdef BRICK_CHECKPOINT
+
+
+#ifdef BRICK_COMPACT
+//Sets (or clears, with a null `relocate`) the callback told about every allocation moved to make room
+//for a malloc that would otherwise fail. `maxMoveBlocks` caps the blocks one malloc may move (0: no cap).
+//brickSetRelocate :: brickContext* -> brickRelocateFn -> uint32 -> void* -> Effect
+void brickSetRelocate(brickContext* ctx, brickRelocateFn relocate, uint32 maxMoveBlocks, void* userData) {
+    ctx->relocateFn        = relocate;
+    ctx->relocateMaxBlocks = maxMoveBlocks;
+    ctx->relocateUserData  = userData;
+}
+#endif //ifdef BRICK_COMPACT
+
+
+#ifdef BRICK_CONCURRENT
+//Attaches sequence counters (BRICK_SEQ_WORDS(numBlocks, regionShift) words, zeroed) to one slab: one
+//counter for every 2^regionShift blocks. Compaction bumps them around each move, for brickRead to check.
+//brickSeqAttach :: brickContext* -> [uint32] -> uint32 -> Effect
+void brickSeqAttach(brickContext* slab, uint32* seqs, uint32 regionShift) {
+    slab->seqShift = regionShift;
+    slab->seqs     = seqs;
+}
+
+
+//Copies `length` bytes from `offset` into the allocation whose key is kept at `keyRef` (which the
+//relocation callback updates), retrying if compaction moved it in the meantime. Needs no lock.
+//Returns `length`, or BRICK_ALLOC_ERROR if the key or byte range lies outside its slab.
+//CONCURRENCY NOTE: Safe against compaction on another thread, not against the allocation being freed.
+//brickRead :: brickContext* -> uint32* -> uint32 -> void* -> uint32 -> uint32
+uint32 brickRead(brickContext* ctx, const volatile uint32* keyRef, uint32 offset, void* dst, uint32 length) {
+    uint32 key         = 0;
+    uint32 block       = 0;
+    uint32 seq         = 0;
+    brickContext* slab = 0;
+
+    for(;;) {
+        key  = BRICK_LOAD_ACQUIRE(keyRef);
+        slab = brickResolve(ctx, key, &block);
+        if(!slab || (block >= slab->numBlocks) || ((uint64)offset+length > (uint64)(slab->numBlocks-block)*slab->blockSize)) {
+            return BRICK_ALLOC_ERROR;
+        }
+        if(!slab->seqs) {
+            memcpy(dst, &slab->memory[(uint64)block*slab->blockSize + offset], length);
+            return length;
+        }
+
+        //a move always covers the old first block, so its region's counter is the only one to watch:
+        seq = BRICK_LOAD_ACQUIRE(&slab->seqs[block >> slab->seqShift]);
+        if((seq & 1) || (BRICK_LOAD_ACQUIRE(keyRef) != key)) {
+            continue;
+        }
+
+        memcpy(dst, &slab->memory[(uint64)block*slab->blockSize + offset], length);
+
+        BRICK_FENCE_ACQUIRE();
+        if(BRICK_LOAD_ACQUIRE(&slab->seqs[block >> slab->seqShift]) == seq) {
+            return length;
+        }
+    }
+}
+
+
+//One bounded step of background defragmentation: slides the allocations right after the first gap of
+//the first slab that has one down into it, moving at most `maxMoveBlocks` blocks (but always at least one allocation).
+//Returns the number of blocks moved: 0 once everything is packed, or if no relocation callback is set.
+//CONCURRENCY NOTE: Must not run alongside mallocs, frees or writes on `ctx`; brickRead may run alongside.
+//brickCompactStep :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickCompactStep(brickContext* ctx, uint32 maxMoveBlocks) {
+    brickContext* slab = ctx;
+    uint32 first       = 0;
+    uint32 last        = 0;
+    uint32 end         = 0;
+    uint32 moved       = 0;
+
+    if(!ctx->relocateFn) {
+        return 0;
+    }
+
+    for(; slab; slab = BRICK_NEXT_SLAB(slab)) {
+        if(!BRICK_FLAT(slab)) {
+            continue;
+        }
+        first = brickNextFreeRun(slab, 0, &last);
+        if(last >= slab->numBlocks) {
+            continue;
+        }
+
+        //take whole allocations from just past the gap, while they stay under the limit:
+        while((last < slab->numBlocks) && slab->blockptrlist[last]) {
+            for(end = last; (end < slab->numBlocks) && (slab->blockptrlist[end] == slab->blockptrlist[last]); end++) { continue; }
+            if(moved && (moved + (end-last) > maxMoveBlocks)) {
+                break;
+            }
+            moved += end-last;
+            last   = end;
+        }
+
+        brickCompactSlide(ctx, slab, first, last);
+        return moved;
+    }
+
+    return 0;
+}
+#endif //ifdef BRICK_CONCURRENT
+
+
+#ifdef BRICK_REGIONS
+//Attaches a region log of `capacity` entries to `ctx`. Each open scope takes one entry, and each allocation made under it one more.
+//brickRegionAttach :: brickContext* -> [uint32] -> uint32 -> Effect
+void brickRegionAttach(brickContext* ctx, uint32* log, uint32 capacity) {
+    ctx->regionLog      = log;
+    ctx->regionCapacity = capacity;
+    ctx->regionLength   = 0;
+    ctx->regionDepth    = 0;
+}
+
+
+//Opens a scope: every brickMalloc/brickCalloc from here until its release is recorded.
+//Returns the scope's token, or BRICK_ALLOC_ERROR if the region log is missing or full.
+//brickMark :: brickContext* -> Effect -> uint32
+uint32 brickMark(brickContext* ctx) {
+    if(ctx->regionLength >= ctx->regionCapacity) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    ctx->regionLog[ctx->regionLength] = BRICK_REGION_MARK;
+    ctx->regionDepth++;
+
+    return ctx->regionLength++;
+}
+
+
+//Frees everything allocated since the mark `token` (newest first), closing it and any scopes nested in it.
+//Returns the number of allocations freed, or BRICK_ALLOC_ERROR if `token` is not an open scope.
+//brickRelease :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickRelease(brickContext* ctx, uint32 token) {
+    uint32 freed = 0;
+    uint32 key   = 0;
+
+    if((token >= ctx->regionLength) || (ctx->regionLog[token] != BRICK_REGION_MARK)) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    while(ctx->regionLength > token) {
+        key = ctx->regionLog[--ctx->regionLength];
+        if(key == BRICK_REGION_MARK) {
+            ctx->regionDepth--;
+            continue;
+        }
+        brickFree(ctx, key);
+        freed++;
+    }
+
+    return freed;
+}
+#endif //ifdef BRICK_REGIONS
+
+
+#ifdef BRICK_TAGS
+//Attaches a tag table of `numTags` entries (all emptied, with no quota) and a link array (one entry per block) to `ctx`.
+//Slabs chained in later that should hold tagged allocations need links of their own: see brickTagSlabAttach.
+//brickTagAttach :: brickContext* -> [brickTag] -> uint32 -> [brickTagLink] -> Effect
+void brickTagAttach(brickContext* ctx, brickTag* tags, uint32 numTags, brickTagLink* links) {
+    uint32 i = 0;
+
+    for(; i < numTags; i++) {
+        tags[i].head   = BRICK_TAG_NONE;
+        tags[i].blocks = 0;
+        tags[i].quota  = 0;
+    }
+
+    ctx->tags    = tags;
+    ctx->numTags = numTags;
+    brickTagSlabAttach(ctx, links);
+}
+
+
+//Attaches a link array (one entry per block) to one slab, so tagged allocations can live in it.
+//brickTagSlabAttach :: brickContext* -> [brickTagLink] -> Effect
+void brickTagSlabAttach(brickContext* slab, brickTagLink* links) {
+    uint32 i = 0;
+
+    for(; i < slab->numBlocks; i++) {
+        links[i].tag = BRICK_TAG_NONE;
+    }
+
+    slab->tagLinks = links;
+}
+
+
+//Caps the number of blocks allocations tagged `tag` may hold at once (0: no cap).
+//brickTagSetQuota :: brickContext* -> uint32 -> uint32 -> Effect
+void brickTagSetQuota(brickContext* ctx, uint32 tag, uint32 maxBlocks) {
+    if(tag < ctx->numTags) {
+        ctx->tags[tag].quota = maxBlocks;
+    }
+}
+
+
+//Returns the number of blocks allocations tagged `tag` hold right now.
+//brickTagBlocks :: brickContext* -> uint32 -> uint32
+uint32 brickTagBlocks(brickContext* ctx, uint32 tag) {
+    return (tag < ctx->numTags) ? ctx->tags[tag].blocks : 0;
+}
+
+
+//Like brickMalloc, but charges the allocation to `tag`: every block it reserves, so a buddy slab's
+//rounding up counts. Fails if that would put the tag over its quota, or if the allocation can only be
+//made in a slab without tag links.
+//brickMallocTagged :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickMallocTagged(brickContext* ctx, uint32 size, uint32 tag) {
+    uint32 blocks      = swedeRoundUp(size, ctx->blockSize) / ctx->blockSize;
+    uint32 key         = 0;
+    uint32 block       = 0;
+    uint32 i           = 0;
+    brickTagLink* link = 0;
+    brickContext* slab = 0;
+
+    if((tag >= ctx->numTags) || !blocks) {
+        return BRICK_ALLOC_ERROR;
+    }
+    if(ctx->tags[tag].quota && ((uint64)ctx->tags[tag].blocks + blocks > ctx->tags[tag].quota)) {
+        return BRICK_ALLOC_ERROR;
+    }
+#ifdef BRICK_WAIT
+    if(brickWaitersAhead(ctx)) {
+        return BRICK_ALLOC_ERROR;
+    }
+#endif //ifdef BRICK_WAIT
+
+    key = brickAlloc(ctx, size, 0);
+    if(key == BRICK_ALLOC_ERROR) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    //charge what was reserved, which a buddy slab rounds up to a power of two:
+    slab = brickResolve(ctx, key, &block);
+    for(i = block; (i < slab->numBlocks) && (slab->blockptrlist[i] == slab->blockptrlist[block]); i++) { continue; }
+    blocks = i-block;
+
+    link = brickTagLinkOf(ctx, key);
+    if(!link || (ctx->tags[tag].quota && ((uint64)ctx->tags[tag].blocks + blocks > ctx->tags[tag].quota))) {
+        brickFree(ctx, key);
+        return BRICK_ALLOC_ERROR;
+    }
+    brickTagPush(ctx, link, key, tag, blocks);
+
+    return key;
+}
+
+
+//Frees every allocation tagged `tag`, walking only the tag's own list. Returns the number freed.
+//brickFreeTag :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickFreeTag(brickContext* ctx, uint32 tag) {
+    uint32 freed = 0;
+
+    if(tag >= ctx->numTags) {
+        return 0;
+    }
+
+    //brickFree unlinks each head in turn:
+    while(ctx->tags[tag].head != BRICK_TAG_NONE) {
+        brickFree(ctx, ctx->tags[tag].head);
+        freed++;
+    }
+
+    return freed;
+}
+#endif //ifdef BRICK_TAGS
+
+
+#ifdef BRICK_WAIT
+//Allocates `size` bytes if that can be done now and nobody is queued ahead; returns the key, and `fn` is not called.
+//Otherwise queues `waiter` and returns BRICK_ALLOC_PENDING: a later brickFree calls `fn` with the key.
+//Returns BRICK_ALLOC_ERROR for requests no slab of the context could ever hold (on a buddy slab, more than
+//the largest power of two blocks it has), since no free could ever serve them.
+//brickMallocAsync :: brickContext* -> uint32 -> brickWaiter* -> brickWaitFn -> void* -> Effect -> uint32
+uint32 brickMallocAsync(brickContext* ctx, uint32 size, brickWaiter* waiter, brickWaitFn fn, void* userData) {
+    uint32 blocks      = swedeRoundUp(size, ctx->blockSize) / ctx->blockSize;
+    uint32 key         = 0;
+    brickContext* slab = ctx;
+
+    //queue-jumping would starve big requests behind a stream of small ones:
+    if(!ctx->waitHead) {
+        key = brickAlloc(ctx, size, 0);
+        if(key != BRICK_ALLOC_ERROR) {
+            return key;
+        }
+    }
+
+    while(slab && (brickSlabLimit(slab) < blocks)) {
+        slab = BRICK_NEXT_SLAB(slab);
+    }
+    if(!blocks || !slab) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    waiter->next     = 0;
+    waiter->size     = size;
+    waiter->blocks   = blocks;
+    waiter->key      = BRICK_ALLOC_PENDING;
+    waiter->fn       = fn;
+    waiter->userData = userData;
+
+    if(ctx->waitTail) {
+        ctx->waitTail->next = waiter;
+    } else {
+        ctx->waitHead = waiter;
+    }
+    ctx->waitTail = waiter;
+
+    return BRICK_ALLOC_PENDING;
+}
+
+
+//Takes a queued waiter back out of the queue. Returns 0 if it wasn't queued (it may have just been served).
+//brickWaitCancel :: brickContext* -> brickWaiter* -> Effect -> uint32
+uint32 brickWaitCancel(brickContext* ctx, brickWaiter* waiter) {
+    brickWaiter* prev = 0;
+    brickWaiter* cur  = ctx->waitHead;
+
+    while(cur && (cur != waiter)) {
+        prev = cur;
+        cur  = cur->next;
+    }
+    if(!cur) {
+        return 0;
+    }
+
+    if(prev) {
+        prev->next = waiter->next;
+    } else {
+        ctx->waitHead = waiter->next;
+    }
+    if(ctx->waitTail == waiter) {
+        ctx->waitTail = prev;
+    }
+    waiter->next = 0;
+
+    //the new oldest waiter has never been tried on its own:
+    if(!prev) {
+        brickServeWaiters(ctx);
+    }
+
+    return 1;
+}
+
+
+//Takes and gives back the context's lock. Threads sharing a context that uses brickMallocWait()
+//must hold it around every call on the context.
+//brickLock :: brickContext* -> Effect
+void brickLock(brickContext* ctx) {
+    brickMutexLock(&ctx->waitLock);
+}
+
+
+//brickUnlock :: brickContext* -> Effect
+void brickUnlock(brickContext* ctx) {
+    brickMutexUnlock(&ctx->waitLock);
+}
+
+
+//Tears down the context's lock and wait condition. Call it once no thread holds the lock or waits,
+//before the context's memory goes away or it is brickInit'ed again.
+//brickWaitDestroy :: brickContext* -> Effect
+void brickWaitDestroy(brickContext* ctx) {
+    brickCondDestroy(&ctx->waitCond);
+    brickMutexDestroy(&ctx->waitLock);
+}
+
+
+//brickMallocWait's waiter callback: the waiting thread checks its own waiter once woken.
+//brickWaitWake :: brickContext* -> brickWaiter* -> uint32 -> void* -> Effect
+static void brickWaitWake(brickContext* ctx, brickWaiter* waiter, uint32 key, void* userData) {
+    brickCondBroadcast(&ctx->waitCond);
+}
+
+
+//Like brickMalloc, but waits up to `timeoutMs` milliseconds (or BRICK_WAIT_FOREVER) for room.
+//Returns BRICK_ALLOC_ERROR if it timed out, or if no slab could ever hold the request.
+//CONCURRENCY NOTE: Call with brickLock held. The lock is given up while waiting, and held again on return.
+//brickMallocWait :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickMallocWait(brickContext* ctx, uint32 size, uint32 timeoutMs) {
+    brickWaiter waiter;
+    uint64 deadline = BRICK_DEADLINE_NONE;
+    uint32 key      = brickMallocAsync(ctx, size, &waiter, brickWaitWake, 0);
+
+    if(key != BRICK_ALLOC_PENDING) {
+        return key;
+    }
+    if(timeoutMs != BRICK_WAIT_FOREVER) {
+        deadline = brickNowMs() + timeoutMs;
+    }
+
+    while(waiter.key == BRICK_ALLOC_PENDING) {
+        if(!brickCondWaitUntil(ctx, deadline)) {
+            break;
+        }
+    }
+
+    //timed out, and still queued (we hold the lock, so nobody can serve it now):
+    if(waiter.key == BRICK_ALLOC_PENDING) {
+        brickWaitCancel(ctx, &waiter);
+        return BRICK_ALLOC_ERROR;
+    }
+
+    return waiter.key;
+}
+#endif //ifdef BRICK_WAIT
+
+
+#ifdef BRICK_TRACE
+//Sets (or clears, with a null `hook`) the callback invoked for every traced operation on `ctx`.
+//brickTraceSetHook :: brickContext* -> brickTraceHook -> void* -> Effect
+void brickTraceSetHook(brickContext* ctx, brickTraceHook hook, void* userData) {
+    ctx->traceHook     = hook;
+    ctx->traceUserData = userData;
+}
+
+
+//Returns the calling thread's trace ring. Hand it to another thread to drain it.
+//LIFETIME NOTE: The ring is thread-local storage and goes away when its thread exits; stop draining it
+//(and drop the pointer) before then. To keep its last events, drain it before the owner exits.
+//brickTraceThreadRing :: brickTraceRing*
+brickTraceRing* brickTraceThreadRing(void) {
+    return &brickLocalTraceRing;
+}
+
+
+//Copies up to `maxEvents` of the oldest events out of `ring`, and returns how many were copied.
+//CONCURRENCY NOTE: Safe to call from any one thread while the ring's owner keeps allocating.
+//brickTraceDrain :: brickTraceRing* -> [brickTraceEvent] -> uint32 -> uint32
+uint32 brickTraceDrain(brickTraceRing* ring, brickTraceEvent* out, uint32 maxEvents) {
+    uint32 n    = 0;
+    uint32 tail = ring->tail;
+    uint32 head = BRICK_LOAD_ACQUIRE(&ring->head);
+
+    for(; (tail != head) && (n < maxEvents); tail++, n++) {
+        out[n] = ring->events[tail & (BRICK_TRACE_RING_SIZE-1)];
+    }
+
+    BRICK_STORE_RELEASE(&ring->tail, tail);
+
+    return n;
 }
+#endif //ifdef BRICK_TRACE
 
 
 //---------------------------------------------------------
\ No newline at end of file
@@ -9,6 +9,30 @@
 #ifndef BRICK_H_
 #define BRICK_H_
 
+#ifdef BRICK_IOVEC
+#if defined(_WIN32)
+#include <stddef.h>
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+#endif //ifdef BRICK_IOVEC
+
+#ifdef BRICK_SHARED
+#include <pthread.h>
+#endif //ifdef BRICK_SHARED
+
+#ifdef BRICK_WAIT
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif //ifdef BRICK_WAIT
+
 
 //---------------------------------------------------------
 // MACRO DEFINITIONS:
@@ -19,17 +43,321 @@
 
 //If BRICK_ZERO_WRITE_DEST_BLOCKS is defined, then the underlying memory will be 
 //zeroed out on brickFree calls. This is a suggested safety feature.
+//It turns off the BRICK_BLOCK_STACK free stack, whose links live in freed blocks. The one exception is
+//the buddy engine: each free buddy block keeps its free-list links (12 bytes) at its start, until handed out.
 //#define BRICK_ZERO_WRITE_DEST_BLOCKS 1
 
+//If BRICK_GROWABLE is defined, a context that runs out of room asks its grow callback
+//for another slab and chains it in, and hands empty trailing slabs to its release callback.
+//Keys then carry the slab number in their top 8 bits; use brickGetPtr() to resolve them.
+//#define BRICK_GROWABLE 1
+
+//Key layout for growable contexts: 8 bits of slab number, 24 bits of block index.
+//Slab 255 is never handed out, so no valid key can collide with BRICK_ALLOC_ERROR.
+//That caps every slab, the head included, at BRICK_BLOCK_MASK+1 (2^24) blocks: brickInit leaves the rest
+//of a bigger head unused, and bigger slabs from the grow callback are given straight back.
+#define BRICK_SLAB_SHIFT     24
+#define BRICK_BLOCK_MASK     0x00FFFFFF
+#define BRICK_MAX_SLABS      255
+#define BRICK_KEY_SLAB(key)  ((key) >> BRICK_SLAB_SHIFT)
+#define BRICK_KEY_BLOCK(key) ((key) & BRICK_BLOCK_MASK)
+
+//If BRICK_PURGE is defined, brickPurge() hands the whole pages inside free runs back to the OS
+//with madvise(), once a purge map has been attached with brickPurgeAttach(). POSIX only.
+//Purged blocks are remembered, so they are not purged twice, and (for slabs attached as anonymous
+//memory) brickCalloc() skips zeroing them.
+//#define BRICK_PURGE 1
+
+//If BRICK_PURGE_MADV_FREE is defined, purging uses MADV_FREE instead of MADV_DONTNEED.
+//It is cheaper, but pages keep their old contents until reclaimed, so they are not assumed zeroed.
+//#define BRICK_PURGE_MADV_FREE 1
+
+//Number of uint32 words a purge map needs for `numBlocks` blocks.
+#define BRICK_PURGE_MAP_WORDS(numBlocks) (((numBlocks)+31)/32)
+
+//If BRICK_CHECKPOINT is defined, contexts with a dirty map attached (brickCheckpointAttach())
+//remember which blocks changed since the last brickCheckpoint(), so only those get written out.
+//Checkpoints cover a single slab: growable contexts can only be checkpointed while nothing is chained in.
+//#define BRICK_CHECKPOINT 1
+
+//Number of uint32 words a dirty map needs for `numBlocks` blocks.
+#define BRICK_DIRTY_MAP_WORDS(numBlocks) (((numBlocks)+31)/32)
+
+//If BRICK_SCATTER is defined, brickMallocScatter() can build an allocation out of several
+//separate free runs when no single run is long enough.
+//#define BRICK_SCATTER 1
+
+//If BRICK_IOVEC is defined, contexts with a length array attached (brickLengthsAttach())
+//record the byte size of each allocation, and brickToIovec() exports allocations for readv/writev.
+//#define BRICK_IOVEC 1
+
+//If BRICK_BLOCK_STACK is defined, freed single-block allocations are pushed onto a LIFO stack
+//(linked through the first 4 bytes of each free block), and single-block mallocs pop from it
+//instead of searching. Runs handed out by the normal search drop the stack if they could overlap it.
+//Nothing is pushed under BRICK_ZERO_WRITE_DEST_BLOCKS, since the links would undo the zeroing.
+//#define BRICK_BLOCK_STACK 1
+
+//If BRICK_BUDDY is defined, contexts set up with brickInitEngine() can run a buddy allocator
+//over the same slab and pointer array: allocations are rounded up to a power of two blocks,
+//split off per-order free lists, and merged with their buddy on free. Both take O(log n).
+//#define BRICK_BUDDY 1
+
+//Allocation engines for brickInitEngine().
+#define BRICK_ENGINE_FLAT  0
+#define BRICK_ENGINE_BUDDY 1
+
+//Number of buddy free lists (orders 0 through 31).
+#define BRICK_BUDDY_ORDERS 32
+
+//If BRICK_COMPACT is defined, a malloc that finds no free run long enough (on a context with a
+//relocation callback set) slides the fewest allocations it can to open one, and reports each move.
+//Keys of moved allocations change, so the callback must update whatever still holds the old ones.
+//#define BRICK_COMPACT 1
+
+//If BRICK_CONCURRENT is defined alongside BRICK_COMPACT, compaction can run while other threads read:
+//brickRead() resolves keys under per-region sequence counters (attached with brickSeqAttach()) and retries
+//if a move raced with it, and brickCompactStep() defragments a bounded amount at a time in the background.
+//#define BRICK_CONCURRENT 1
+
+//Number of uint32 words of sequence counters a slab of `numBlocks` blocks needs, one per 2^`shift` blocks.
+#define BRICK_SEQ_WORDS(numBlocks, shift) (((numBlocks) + (1u << (shift)) - 1) >> (shift))
+
+//If BRICK_REGIONS is defined, brickMark() opens a scope on a context with a region log attached
+//(brickRegionAttach()), and brickRelease() frees everything brickMalloc'ed or brickCalloc'ed since.
+//Allocations made under a scope belong to it: don't brickFree them yourself.
+//#define BRICK_REGIONS 1
+
+//If BRICK_WAIT is defined, allocations that don't fit can wait for room instead of failing:
+//brickMallocAsync() queues a callback, and brickMallocWait() blocks the calling thread.
+//Waiters are served in FIFO order, from brickFree, once a free run big enough for the first one opens up
+//(with BRICK_COMPACT and a relocation callback: once its slab has enough free blocks to compact into one).
+//While any are queued, other mallocs fail rather than jump the queue. brickWaitDestroy() tears down the lock.
+//#define BRICK_WAIT 1
+
+//Returned by brickMallocAsync() when the request was queued. Never a valid key, as long as
+//a context has fewer than 0xFFFFFFFE blocks.
+#define BRICK_ALLOC_PENDING 0xFFFFFFFE
+
+//brickMallocWait() timeout that never expires.
+#define BRICK_WAIT_FOREVER 0xFFFFFFFF
+
+//If BRICK_TAGS is defined, brickMallocTagged() charges allocations to a tag (a tenant, say), keeping
+//per-tag block counts and quotas, and brickFreeTag() frees all of a tag's allocations at once.
+//Tagged allocations are kept on per-tag lists threaded through a link array attached with brickTagAttach().
+//#define BRICK_TAGS 1
+
+//Ends tag lists, and marks allocations that aren't tagged.
+#define BRICK_TAG_NONE 0xFFFFFFFF
+
+//If BRICK_SHARED is defined, brickSharedCreate()/brickSharedAttach() (in brick_arena) lay a context out
+//in a shared memory file (shm_open, memfd_create) that several processes map. The pointer array then
+//holds block offsets rather than addresses, and brickMalloc/brickFree take a robust process-shared lock,
+//so keys mean the same thing in every attached process. POSIX only, and only with options that keep
+//no state of their own in the context (so not with GROWABLE, BLOCK_STACK, BUDDY, COMPACT, WAIT, TAGS,
+//PURGE, CHECKPOINT or IOVEC).
+//#define BRICK_SHARED 1
+
+//If BRICK_TRACE is defined, brickMalloc, brickFree and brickGC record an event into
+//a per-thread ring buffer and call the context's trace hook (if one is set).
+//When it is not defined, all of the instrumentation compiles away to nothing.
+//#define BRICK_TRACE 1
+
+//If BRICK_TRACE_USDT is defined alongside BRICK_TRACE, every event also fires a
+//USDT static probe (brick:malloc, brick:free, brick:gc). Requires <sys/sdt.h>.
+//#define BRICK_TRACE_USDT 1
+
+//Number of events each thread's trace ring can hold. Must be a power of two.
+#ifndef BRICK_TRACE_RING_SIZE
+#define BRICK_TRACE_RING_SIZE 256
+#endif
+
+//Trace event operation codes.
+#define BRICK_OP_MALLOC 1
+#define BRICK_OP_FREE   2
+#define BRICK_OP_GC     3
+
 
 //---------------------------------------------------------
 // DATA STRUCTURES & TYPEDEFS:
 
+struct brickContext;
+
+#ifdef BRICK_SCATTER
+//One run of a scatter allocation: an ordinary allocation of `blocks` blocks at `key`.
+typedef struct brickSegment {
+    uint32 key;
+    uint32 blocks;
+} brickSegment;
+
+//A scatter allocation: `numSegments` runs, in order, making up at least `size` bytes.
+//The segment array belongs to the caller.
+typedef struct brickScatter {
+    brickSegment* segments;
+    uint32 maxSegments;
+    uint32 numSegments;
+    uint32 size;
+} brickScatter;
+#endif //ifdef BRICK_SCATTER
+
+#ifdef BRICK_GROWABLE
+//Returns a new slab (already set up with brickInit, using the same block size) with room
+//for at least `minBlocks` blocks, or 0 if the context can't grow. The slab's storage is owned by the callback.
+typedef struct brickContext* (*brickGrowFn)(struct brickContext* ctx, uint32 minBlocks, void* userData);
+
+//Takes back a slab handed out by the grow callback, once it is empty and at the end of the chain.
+typedef void (*brickReleaseFn)(struct brickContext* ctx, struct brickContext* slab, void* userData);
+#endif //ifdef BRICK_GROWABLE
+
+#ifdef BRICK_COMPACT
+//Called once for every allocation compaction moves, with its old and new key. Runs inside the
+//malloc that triggered the move, so it must not call back into the allocator.
+typedef void (*brickRelocateFn)(struct brickContext* ctx, uint32 oldKey, uint32 newKey, void* userData);
+#endif //ifdef BRICK_COMPACT
+
+#ifdef BRICK_TAGS
+//Per-tag bookkeeping. `head` is the key of the tag's most recent allocation, or BRICK_TAG_NONE.
+typedef struct brickTag {
+    uint32 head;
+    uint32 blocks;
+    uint32 quota;              //most blocks the tag may hold at once; 0 for no limit.
+} brickTag;
+
+//Tag list links, indexed by the first block of each allocation. `next` and `prev` are keys.
+typedef struct brickTagLink {
+    uint32 next;
+    uint32 prev;
+    uint32 tag;                //BRICK_TAG_NONE if the allocation isn't tagged.
+    uint32 blocks;
+} brickTagLink;
+#endif //ifdef BRICK_TAGS
+
+#ifdef BRICK_SHARED
+//Start of a shared mapping: the layout every attached process agrees on, and the lock they take turns with.
+typedef struct brickSharedHeader {
+    uint64 magic;
+    uint64 mapBytes;
+    uint64 slabOffset;         //from the start of the mapping. The pointer array follows this header.
+    uint32 numBlocks;
+    uint32 blockSize;
+    pthread_mutex_t lock;
+} brickSharedHeader;
+#endif //ifdef BRICK_SHARED
+
+#ifdef BRICK_WAIT
+#if defined(_WIN32)
+typedef SRWLOCK brickMutex;
+typedef CONDITION_VARIABLE brickCond;
+#else
+typedef pthread_mutex_t brickMutex;
+typedef pthread_cond_t brickCond;
+#endif
+
+struct brickWaiter;
+
+//Called from the brickFree that served a queued request, with the key it was given.
+typedef void (*brickWaitFn)(struct brickContext* ctx, struct brickWaiter* waiter, uint32 key, void* userData);
+
+//A queued request. The caller owns its storage until it is served or cancelled.
+typedef struct brickWaiter {
+    struct brickWaiter* next;
+    uint32 size;
+    uint32 blocks;
+    volatile uint32 key;       //BRICK_ALLOC_PENDING until served.
+    brickWaitFn fn;
+    void* userData;
+} brickWaiter;
+#endif //ifdef BRICK_WAIT
+
+#ifdef BRICK_TRACE
+//One allocator operation. `key` is BRICK_ALLOC_ERROR for failed mallocs,
+//and `cycles` is the time spent searching (malloc) or in the whole call (free/GC).
+typedef struct brickTraceEvent {
+    struct brickContext* ctx;
+    uint32 op;
+    uint32 key;
+    uint32 blocks;
+    uint64 cycles;
+} brickTraceEvent;
+
+//Single-producer/single-consumer ring: only the owning thread writes `head`,
+//only the draining thread writes `tail`. Events are dropped (and counted) when full.
+typedef struct brickTraceRing {
+    volatile uint32 head;
+    volatile uint32 tail;
+    volatile uint32 dropped;
+    brickTraceEvent events[BRICK_TRACE_RING_SIZE];
+} brickTraceRing;
+
+typedef void (*brickTraceHook)(struct brickContext* ctx, const brickTraceEvent* ev, void* userData);
+#endif //ifdef BRICK_TRACE
+
 typedef struct brickContext {
     char** blockptrlist;
     char* memory;
     uint32 numBlocks;
     uint32 blockSize;
+#ifdef BRICK_GROWABLE
+    struct brickContext* next; //next slab in the chain.
+    uint32 slabIndex;
+    uint32 usedBlocks;
+    brickGrowFn growFn;        //growth settings are only read from the head context.
+    brickReleaseFn releaseFn;
+    void* growUserData;
+#endif //ifdef BRICK_GROWABLE
+#ifdef BRICK_PURGE
+    uint32* purgeMap;          //one bit per block: set if the block's pages were purged since its last use.
+    uint32 purgeThreshold;
+    uint32 purgeAnonymous;     //purged pages read back as zeros (private anonymous memory).
+#endif //ifdef BRICK_PURGE
+#ifdef BRICK_CHECKPOINT
+    uint32* dirtyMap;          //one bit per block: set if the block changed since the last checkpoint.
+    uint32 checkpointEpoch;
+#endif //ifdef BRICK_CHECKPOINT
+#ifdef BRICK_IOVEC
+    uint32* lengths;           //byte length of each allocation, indexed by its first block.
+#endif //ifdef BRICK_IOVEC
+#ifdef BRICK_BLOCK_STACK
+    uint32 stackTop;           //most recently freed single block, or BRICK_ALLOC_ERROR.
+    uint32 stackLow;           //bounds of every block pushed since the stack was last emptied.
+    uint32 stackHigh;
+#endif //ifdef BRICK_BLOCK_STACK
+#ifdef BRICK_BUDDY
+    uint32 engine;
+    uint32 buddyFree[BRICK_BUDDY_ORDERS]; //first free block of each order, or BRICK_ALLOC_ERROR.
+#endif //ifdef BRICK_BUDDY
+#ifdef BRICK_CONCURRENT
+    uint32* seqs;              //one sequence counter per region of 2^seqShift blocks, odd while a move is under way.
+    uint32 seqShift;
+#endif //ifdef BRICK_CONCURRENT
+#ifdef BRICK_COMPACT
+    brickRelocateFn relocateFn; //relocation settings are only read from the head context.
+    uint32 relocateMaxBlocks;
+    void* relocateUserData;
+#endif //ifdef BRICK_COMPACT
+#ifdef BRICK_REGIONS
+    uint32* regionLog;         //keys allocated under open scopes, with a mark entry where each scope starts.
+    uint32 regionCapacity;
+    uint32 regionLength;
+    uint32 regionDepth;        //number of open scopes.
+#endif //ifdef BRICK_REGIONS
+#ifdef BRICK_TAGS
+    brickTag* tags;            //the tag table is only read from the head context; links are per slab.
+    uint32 numTags;
+    brickTagLink* tagLinks;
+#endif //ifdef BRICK_TAGS
+#ifdef BRICK_SHARED
+    brickSharedHeader* shared; //this process's view of the shared mapping, or 0 for a private context.
+#endif //ifdef BRICK_SHARED
+#ifdef BRICK_WAIT
+    brickWaiter* waitHead;     //FIFO of queued requests.
+    brickWaiter* waitTail;
+    brickMutex waitLock;
+    brickCond waitCond;
+#endif //ifdef BRICK_WAIT
+#ifdef BRICK_TRACE
+    brickTraceHook traceHook;
+    void* traceUserData;
+#endif //ifdef BRICK_TRACE
 } brickContext;
 
 
@@ -40,6 +368,13 @@ typedef struct brickContext {
 //brickInit :: brickContext* -> [char*] -> char* -> uint32 -> uint32 -> Effect
 void brickInit(brickContext* ctx, char** blockPtrList, char* memory, uint32 numBlocks, uint32 blockSize);
 
+#ifdef BRICK_BUDDY
+//Like brickInit, but picks the allocation engine the context runs: BRICK_ENGINE_FLAT (first fit) or BRICK_ENGINE_BUDDY.
+//The buddy engine needs blocks of at least 12 bytes; with smaller ones the context stays flat.
+//brickInitEngine :: brickContext* -> [char*] -> char* -> uint32 -> uint32 -> uint32 -> Effect
+void brickInitEngine(brickContext* ctx, char** blockPtrList, char* memory, uint32 numBlocks, uint32 blockSize, uint32 engine);
+#endif //ifdef BRICK_BUDDY
+
 //Returns the starting index/key of the first fit for an allocation of length `length`.
 //Returns 0 on failure, 1+ on success. (thus, our indexes start at 1, much like in Lua.)
 //brickFindOpenRun :: brickContext* -> uint32 -> uint32
@@ -50,16 +385,228 @@ uint32 brickFindOpenRun(brickContext* ctx, uint32 length);
 //blockMalloc :: brickContext -> uint32 -> Effect -> uint32
 uint32 brickMalloc(brickContext* ctx, uint32 size);
 
+//Like brickMalloc, but the allocated memory is zeroed out.
+//brickCalloc :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickCalloc(brickContext* ctx, uint32 size);
+
 //"Frees" memory by zeroing out the pointers in the pointer array.
 //NOTE: if BRICK_ZERO_WRITE_DEST_BLOCKS is set, then the blocks of memory will also be zeroed out.
 //blockFree :: brickContext* -> uint32 -> Effect
 void brickFree(brickContext* ctx, uint32 key);
 
+//Returns the pointer to the start of the allocation a key refers to (0 if it is free).
+//brickGetPtr :: brickContext* -> uint32 -> char*
+char* brickGetPtr(brickContext* ctx, uint32 key);
+
 //A full, stop-the-world compaction of the blocklist.
 //CONCURRENCY NOTE: Needs to be wrapped in a mutex or critical section for safe use.
 //brickGC :: brickContext* -> Effect
 void brickGC(brickContext* ctx);
 
+#ifdef BRICK_GROWABLE
+//Sets the callbacks used to chain in a new slab when `ctx` runs out of room, and to give back empty ones.
+//brickSetGrowth :: brickContext* -> brickGrowFn -> brickReleaseFn -> void* -> Effect
+void brickSetGrowth(brickContext* ctx, brickGrowFn grow, brickReleaseFn release, void* userData);
+#endif //ifdef BRICK_GROWABLE
+
+#ifdef BRICK_SCATTER
+//Allocates at least `size` bytes as up to `maxSegments` separate runs, filling in `sg` (which
+//keeps using the caller's `segments` array). A single contiguous run is always tried first, just like
+//brickMalloc: with BRICK_COMPACT and a relocation callback, that try may move (and rekey) other allocations.
+//Returns the number of segments used, or BRICK_ALLOC_ERROR on failure (nothing stays allocated).
+//brickMallocScatter :: brickContext* -> uint32 -> brickScatter* -> [brickSegment] -> uint32 -> Effect -> uint32
+uint32 brickMallocScatter(brickContext* ctx, uint32 size, brickScatter* sg, brickSegment* segments, uint32 maxSegments);
+
+//Translates a byte offset into a scatter allocation to a pointer. If `contiguous` is not null, it receives
+//the number of bytes that can be accessed from that pointer before the next segment (or the end of `size`).
+//Returns 0 for offsets at or past `sg->size`, even where the last segment's padding would still fit them.
+//brickScatterPtr :: brickContext* -> brickScatter* -> uint32 -> uint32* -> char*
+char* brickScatterPtr(brickContext* ctx, brickScatter* sg, uint32 offset, uint32* contiguous);
+
+//Frees every segment of a scatter allocation.
+//brickFreeScatter :: brickContext* -> brickScatter* -> Effect
+void brickFreeScatter(brickContext* ctx, brickScatter* sg);
+#endif //ifdef BRICK_SCATTER
+
+#ifdef BRICK_IOVEC
+//Attaches a length array (one uint32 per block) to `ctx`, so allocations remember their size in bytes.
+//Allocations that already exist are recorded as spanning all of their blocks.
+//brickLengthsAttach :: brickContext* -> [uint32] -> Effect
+void brickLengthsAttach(brickContext* ctx, uint32* lengths);
+
+//Returns the length in bytes of the allocation at `key`: its recorded length if there is one,
+//otherwise every block it spans.
+//brickLength :: brickContext* -> uint32 -> uint32
+uint32 brickLength(brickContext* ctx, uint32 key);
+
+//Fills up to `*iovcnt` iovecs with the bytes of the `n` allocations in `keys`, in order, merging
+//allocations that sit back to back in memory. `*iovcnt` receives the number of iovecs used.
+//Returns the number of keys exported: less than `n` if the iovecs ran out or a key was free.
+//brickToIovec :: brickContext* -> [uint32] -> uint32 -> [iovec] -> uint32* -> uint32
+uint32 brickToIovec(brickContext* ctx, const uint32* keys, uint32 n, struct iovec* iov, uint32* iovcnt);
+#endif //ifdef BRICK_IOVEC
+
+#ifdef BRICK_PURGE
+//Attaches a purge map (BRICK_PURGE_MAP_WORDS(numBlocks) words) to `ctx`. If `thresholdBytes` is
+//nonzero, any brickFree of at least that many bytes also purges the free run around it.
+//Set `anonymous` only if the slab is private anonymous memory: its purged pages read back as zeros, so
+//brickCalloc() can skip them. Purged pages of a file mapping read back as the file, and are memset as usual.
+//brickPurgeAttach :: brickContext* -> [uint32] -> uint32 -> uint32 -> Effect
+void brickPurgeAttach(brickContext* ctx, uint32* purgeMap, uint32 thresholdBytes, uint32 anonymous);
+
+//Gives the whole pages inside every free run of at least `minBytes` back to the OS.
+//Returns the number of bytes released.
+//brickPurge :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickPurge(brickContext* ctx, uint32 minBytes);
+#endif //ifdef BRICK_PURGE
+
+#ifdef BRICK_CHECKPOINT
+//Attaches a dirty map (BRICK_DIRTY_MAP_WORDS(numBlocks) words) to `ctx`. Every block starts
+//out dirty, so the first checkpoint taken is a full base image.
+//brickCheckpointAttach :: brickContext* -> [uint32] -> Effect
+void brickCheckpointAttach(brickContext* ctx, uint32* dirtyMap);
+
+//Flags every block of the allocation at `key` as changed, so the next checkpoint writes it out.
+//Blocks are flagged automatically when they are allocated or freed; call this after writing to them.
+//brickMarkDirty :: brickContext* -> uint32 -> Effect
+void brickMarkDirty(brickContext* ctx, uint32 key);
+
+//Writes every block changed since the last checkpoint (with its metadata) to `fd`, and starts a new epoch.
+//Only the head slab is covered: with BRICK_GROWABLE, a context that has chained slabs in is refused.
+//Returns the number of blocks written, or BRICK_ALLOC_ERROR if a write failed or slabs are chained in.
+//brickCheckpoint :: brickContext* -> int -> Effect -> uint32
+uint32 brickCheckpoint(brickContext* ctx, int fd);
+
+//Replays checkpoints from `fd` (a base image, then any deltas after it) into `ctx` until end of file.
+//`ctx` must already be brickInit'ed with the same block count and size as the checkpointed context.
+//Lengths (BRICK_IOVEC) are not checkpointed: every restored allocation is recorded as spanning all of its blocks.
+//With BRICK_GROWABLE, `ctx` must not have slabs chained in (their keys would outlive the restore).
+//Returns the number of checkpoints applied, or BRICK_ALLOC_ERROR on malformed or truncated input.
+//brickRestore :: brickContext* -> int -> Effect -> uint32
+uint32 brickRestore(brickContext* ctx, int fd);
+#endif //ifdef BRICK_CHECKPOINT
+
+#ifdef BRICK_COMPACT
+//Sets (or clears, with a null `relocate`) the callback told about every allocation moved to make room
+//for a malloc that would otherwise fail. `maxMoveBlocks` caps the blocks one malloc may move (0: no cap).
+//brickSetRelocate :: brickContext* -> brickRelocateFn -> uint32 -> void* -> Effect
+void brickSetRelocate(brickContext* ctx, brickRelocateFn relocate, uint32 maxMoveBlocks, void* userData);
+#endif //ifdef BRICK_COMPACT
+
+#ifdef BRICK_CONCURRENT
+//Attaches sequence counters (BRICK_SEQ_WORDS(numBlocks, regionShift) words, zeroed) to one slab: one
+//counter for every 2^regionShift blocks. Compaction bumps them around each move, for brickRead to check.
+//brickSeqAttach :: brickContext* -> [uint32] -> uint32 -> Effect
+void brickSeqAttach(brickContext* slab, uint32* seqs, uint32 regionShift);
+
+//Copies `length` bytes from `offset` into the allocation whose key is kept at `keyRef` (which the
+//relocation callback updates), retrying if compaction moved it in the meantime. Needs no lock.
+//Returns `length`, or BRICK_ALLOC_ERROR if the key or byte range lies outside its slab.
+//CONCURRENCY NOTE: Safe against compaction on another thread, not against the allocation being freed.
+//brickRead :: brickContext* -> uint32* -> uint32 -> void* -> uint32 -> uint32
+uint32 brickRead(brickContext* ctx, const volatile uint32* keyRef, uint32 offset, void* dst, uint32 length);
+
+//One bounded step of background defragmentation: slides the allocations right after the first gap of
+//the first slab that has one down into it, moving at most `maxMoveBlocks` blocks (but always at least one allocation).
+//Returns the number of blocks moved: 0 once everything is packed, or if no relocation callback is set.
+//CONCURRENCY NOTE: Must not run alongside mallocs, frees or writes on `ctx`; brickRead may run alongside.
+//brickCompactStep :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickCompactStep(brickContext* ctx, uint32 maxMoveBlocks);
+#endif //ifdef BRICK_CONCURRENT
+
+#ifdef BRICK_REGIONS
+//Attaches a region log of `capacity` entries to `ctx`. Each open scope takes one entry, and each allocation made under it one more.
+//brickRegionAttach :: brickContext* -> [uint32] -> uint32 -> Effect
+void brickRegionAttach(brickContext* ctx, uint32* log, uint32 capacity);
+
+//Opens a scope: every brickMalloc/brickCalloc from here until its release is recorded.
+//Returns the scope's token, or BRICK_ALLOC_ERROR if the region log is missing or full.
+//brickMark :: brickContext* -> Effect -> uint32
+uint32 brickMark(brickContext* ctx);
+
+//Frees everything allocated since the mark `token` (newest first), closing it and any scopes nested in it.
+//Returns the number of allocations freed, or BRICK_ALLOC_ERROR if `token` is not an open scope.
+//brickRelease :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickRelease(brickContext* ctx, uint32 token);
+#endif //ifdef BRICK_REGIONS
+
+#ifdef BRICK_TAGS
+//Attaches a tag table of `numTags` entries (all emptied, with no quota) and a link array (one entry per block) to `ctx`.
+//Slabs chained in later that should hold tagged allocations need links of their own: see brickTagSlabAttach.
+//brickTagAttach :: brickContext* -> [brickTag] -> uint32 -> [brickTagLink] -> Effect
+void brickTagAttach(brickContext* ctx, brickTag* tags, uint32 numTags, brickTagLink* links);
+
+//Attaches a link array (one entry per block) to one slab, so tagged allocations can live in it.
+//brickTagSlabAttach :: brickContext* -> [brickTagLink] -> Effect
+void brickTagSlabAttach(brickContext* slab, brickTagLink* links);
+
+//Caps the number of blocks allocations tagged `tag` may hold at once (0: no cap).
+//brickTagSetQuota :: brickContext* -> uint32 -> uint32 -> Effect
+void brickTagSetQuota(brickContext* ctx, uint32 tag, uint32 maxBlocks);
+
+//Returns the number of blocks allocations tagged `tag` hold right now.
+//brickTagBlocks :: brickContext* -> uint32 -> uint32
+uint32 brickTagBlocks(brickContext* ctx, uint32 tag);
+
+//Like brickMalloc, but charges the allocation to `tag`: every block it reserves, so a buddy slab's
+//rounding up counts. Fails if that would put the tag over its quota, or if the allocation can only be
+//made in a slab without tag links.
+//brickMallocTagged :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickMallocTagged(brickContext* ctx, uint32 size, uint32 tag);
+
+//Frees every allocation tagged `tag`, walking only the tag's own list. Returns the number freed.
+//brickFreeTag :: brickContext* -> uint32 -> Effect -> uint32
+uint32 brickFreeTag(brickContext* ctx, uint32 tag);
+#endif //ifdef BRICK_TAGS
+
+#ifdef BRICK_WAIT
+//Allocates `size` bytes if that can be done now and nobody is queued ahead; returns the key, and `fn` is not called.
+//Otherwise queues `waiter` and returns BRICK_ALLOC_PENDING: a later brickFree calls `fn` with the key.
+//Returns BRICK_ALLOC_ERROR for requests no slab of the context could ever hold (on a buddy slab, more than
+//the largest power of two blocks it has).
+//brickMallocAsync :: brickContext* -> uint32 -> brickWaiter* -> brickWaitFn -> void* -> Effect -> uint32
+uint32 brickMallocAsync(brickContext* ctx, uint32 size, brickWaiter* waiter, brickWaitFn fn, void* userData);
+
+//Takes a queued waiter back out of the queue. Returns 0 if it wasn't queued (it may have just been served).
+//brickWaitCancel :: brickContext* -> brickWaiter* -> Effect -> uint32
+uint32 brickWaitCancel(brickContext* ctx, brickWaiter* waiter);
+
+//Takes and gives back the context's lock. Threads sharing a context that uses brickMallocWait()
+//must hold it around every call on the context.
+//brickLock :: brickContext* -> Effect
+void brickLock(brickContext* ctx);
+//brickUnlock :: brickContext* -> Effect
+void brickUnlock(brickContext* ctx);
+
+//Tears down the context's lock and wait condition. Call it once no thread holds the lock or waits,
+//before the context's memory goes away or it is brickInit'ed again.
+//brickWaitDestroy :: brickContext* -> Effect
+void brickWaitDestroy(brickContext* ctx);
+
+//Like brickMalloc, but waits up to `timeoutMs` milliseconds (or BRICK_WAIT_FOREVER) for room.
+//Returns BRICK_ALLOC_ERROR if it timed out, or if no slab could ever hold the request.
+//CONCURRENCY NOTE: Call with brickLock held. The lock is given up while waiting, and held again on return.
+//brickMallocWait :: brickContext* -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickMallocWait(brickContext* ctx, uint32 size, uint32 timeoutMs);
+#endif //ifdef BRICK_WAIT
+
+#ifdef BRICK_TRACE
+//Sets (or clears, with a null `hook`) the callback invoked for every traced operation on `ctx`.
+//brickTraceSetHook :: brickContext* -> brickTraceHook -> void* -> Effect
+void brickTraceSetHook(brickContext* ctx, brickTraceHook hook, void* userData);
+
+//Returns the calling thread's trace ring. Hand it to another thread to drain it.
+//LIFETIME NOTE: The ring is thread-local storage and goes away when its thread exits; stop draining it
+//(and drop the pointer) before then. To keep its last events, drain it before the owner exits.
+//brickTraceThreadRing :: brickTraceRing*
+brickTraceRing* brickTraceThreadRing(void);
+
+//Copies up to `maxEvents` of the oldest events out of `ring`, and returns how many were copied.
+//CONCURRENCY NOTE: Safe to call from any one thread while the ring's owner keeps allocating.
+//brickTraceDrain :: brickTraceRing* -> [brickTraceEvent] -> uint32 -> uint32
+uint32 brickTraceDrain(brickTraceRing* ring, brickTraceEvent* out, uint32 maxEvents);
+#endif //ifdef BRICK_TRACE
+
 
 //---------------------------------------------------------
 #endif //ifndef BRICK_H_
\ No newline at end of file
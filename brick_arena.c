@@ -0,0 +1,347 @@
+//-----------------------------------------------------------------------------
+// brick_arena.c -- Optional helpers that map memory for a brick context.
+//                  brick itself never allocates; this is for callers who
+//                  would rather not hand-roll their slabs.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+//MAP_ANONYMOUS, MAP_HUGETLB, madvise and the robust mutex calls are hidden by strict -std=c99 builds;
+//ask for them before any system header comes in.
+#if !defined(_WIN32)
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE 1
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE 1
+#endif
+#endif //if !defined(_WIN32)
+
+#include "types.h"
+#include "brick.h"
+#include "brick_arena.h"
+#include <stddef.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef BRICK_SHARED
+#include <sys/stat.h>
+#endif //ifdef BRICK_SHARED
+
+
+//---------------------------------------------------------
+//DATA STRUCTURES:
+
+//Sits in front of the pointer array, so brickArenaDestroy knows what to unmap.
+typedef struct brickArenaHeader {
+    size_t slabBytes;
+    size_t metaBytes;
+    uint64 pad;           //keeps the pointer array 16-byte aligned.
+    uint64 magic;
+} brickArenaHeader;
+
+#define BRICK_ARENA_MAGIC 0x616E657261697262ull
+
+#ifdef BRICK_SHARED
+#define BRICK_SHARED_MAGIC 0x6465726168736B62ull
+#endif //ifdef BRICK_SHARED
+
+
+//---------------------------------------------------------
+//PLATFORM FUNCTIONS:
+
+#if defined(_WIN32)
+
+//Returns the size of an OS page.
+//brickArenaPageSize :: size_t
+static size_t brickArenaPageSize(void) {
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (size_t)info.dwPageSize;
+}
+
+
+//Maps `*bytes` of memory, honoring what it can of `*flags`. Both are updated to what was actually mapped.
+//brickArenaMap :: size_t* -> uint32* -> Effect -> void*
+static void* brickArenaMap(size_t* bytes, uint32* flags) {
+    void* p           = 0;
+    size_t largeBytes = 0;
+    size_t largePage  = GetLargePageMinimum();
+
+    //large pages need SeLockMemoryPrivilege; without it this just fails and we fall back.
+    if((*flags & BRICK_ARENA_HUGETLB) && largePage) {
+        largeBytes = (*bytes + largePage-1) & ~(largePage-1);
+        p = VirtualAlloc(0, largeBytes, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE);
+        if(p) {
+            *bytes = largeBytes;
+            *flags &= ~(uint32)BRICK_ARENA_THP;
+            return p;
+        }
+    }
+    *flags &= ~(uint32)(BRICK_ARENA_HUGETLB|BRICK_ARENA_THP);
+
+    p = VirtualAlloc(0, *bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    if(p && (*flags & BRICK_ARENA_POPULATE)) {
+        size_t i = 0;
+        size_t pageSize = brickArenaPageSize();
+        for(; i < *bytes; i += pageSize) {
+            ((volatile char*)p)[i] = 0;
+        }
+    }
+
+    return p;
+}
+
+
+//Unmaps memory mapped by brickArenaMap.
+//brickArenaUnmap :: void* -> size_t -> Effect
+static void brickArenaUnmap(void* p, size_t bytes) {
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+
+#else
+
+//Returns the size of an OS page.
+//brickArenaPageSize :: size_t
+static size_t brickArenaPageSize(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+
+//Maps `*bytes` of memory, honoring what it can of `*flags`. Both are updated to what was actually mapped.
+//brickArenaMap :: size_t* -> uint32* -> Effect -> void*
+static void* brickArenaMap(size_t* bytes, uint32* flags) {
+    int mapFlags     = MAP_PRIVATE|MAP_ANONYMOUS;
+    size_t hugeBytes = ((*bytes) + BRICK_ARENA_HUGE_PAGE_SIZE-1) & ~(size_t)(BRICK_ARENA_HUGE_PAGE_SIZE-1);
+    char* p          = 0;
+
+#ifdef MAP_POPULATE
+    if(*flags & BRICK_ARENA_POPULATE) {
+        mapFlags |= MAP_POPULATE;
+    }
+#else
+    *flags &= ~(uint32)BRICK_ARENA_POPULATE;
+#endif //ifdef MAP_POPULATE
+
+#ifdef MAP_HUGETLB
+    if(*flags & BRICK_ARENA_HUGETLB) {
+        p = (char*)mmap(0, hugeBytes, PROT_READ|PROT_WRITE, mapFlags|MAP_HUGETLB, -1, 0);
+        if(p != (char*)MAP_FAILED) {
+            *bytes = hugeBytes;
+            *flags &= ~(uint32)BRICK_ARENA_THP;
+            return p;
+        }
+    }
+#endif //ifdef MAP_HUGETLB
+    *flags &= ~(uint32)BRICK_ARENA_HUGETLB;
+
+#ifdef MADV_HUGEPAGE
+    if(*flags & BRICK_ARENA_THP) {
+        //over-map by a huge page so we can trim down to an aligned stretch:
+        size_t lead = 0;
+        size_t over = hugeBytes + BRICK_ARENA_HUGE_PAGE_SIZE;
+        size_t i    = 0;
+
+        //prefault only after the advice, so the faults can be served with huge pages:
+        p = (char*)mmap(0, over, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(p != (char*)MAP_FAILED) {
+            lead = (BRICK_ARENA_HUGE_PAGE_SIZE - ((size_t)p & (BRICK_ARENA_HUGE_PAGE_SIZE-1))) & (BRICK_ARENA_HUGE_PAGE_SIZE-1);
+            if(lead) {
+                munmap(p, lead);
+            }
+            munmap(p + lead + hugeBytes, over - lead - hugeBytes);
+            p += lead;
+            *bytes = hugeBytes;
+
+            if(madvise(p, hugeBytes, MADV_HUGEPAGE) != 0) {
+                *flags &= ~(uint32)BRICK_ARENA_THP;
+            }
+            if(*flags & BRICK_ARENA_POPULATE) {
+                for(; i < hugeBytes; i += brickArenaPageSize()) {
+                    ((volatile char*)p)[i] = 0;
+                }
+            }
+            return p;
+        }
+    }
+#endif //ifdef MADV_HUGEPAGE
+    *flags &= ~(uint32)BRICK_ARENA_THP;
+
+    p = (char*)mmap(0, *bytes, PROT_READ|PROT_WRITE, mapFlags, -1, 0);
+
+    return (p == (char*)MAP_FAILED) ? 0 : p;
+}
+
+
+//Unmaps memory mapped by brickArenaMap.
+//brickArenaUnmap :: void* -> size_t -> Effect
+static void brickArenaUnmap(void* p, size_t bytes) {
+    munmap(p, bytes);
+}
+
+#endif //if defined(_WIN32)
+
+
+//---------------------------------------------------------
+// FUNCTION IMPLEMENTATIONS:
+
+//Maps a slab of `numBlocks` blocks and its pointer array, then brickInit's `ctx` over them.
+//Huge page requests fall back to regular pages when they can't be met.
+//Returns the flags that actually took effect, or BRICK_ALLOC_ERROR if no memory could be mapped.
+//brickArenaCreate :: brickContext* -> uint32 -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickArenaCreate(brickContext* ctx, uint32 numBlocks, uint32 blockSize, uint32 flags) {
+    size_t pageSize          = brickArenaPageSize();
+    size_t slabBytes         = ((size_t)numBlocks*blockSize + pageSize-1) & ~(pageSize-1);
+    size_t metaBytes         = (sizeof(brickArenaHeader) + (size_t)numBlocks*sizeof(char*) + pageSize-1) & ~(pageSize-1);
+    uint32 metaFlags         = flags & BRICK_ARENA_POPULATE;
+    char* slab               = 0;
+    brickArenaHeader* header = 0;
+
+    if(!numBlocks || !blockSize) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    slab = (char*)brickArenaMap(&slabBytes, &flags);
+    if(!slab) {
+        return BRICK_ALLOC_ERROR;
+    }
+
+    //the pointer array is small and mostly scanned linearly; regular pages do fine:
+    header = (brickArenaHeader*)brickArenaMap(&metaBytes, &metaFlags);
+    if(!header) {
+        brickArenaUnmap(slab, slabBytes);
+        return BRICK_ALLOC_ERROR;
+    }
+
+    header->slabBytes = slabBytes;
+    header->metaBytes = metaBytes;
+    header->magic     = BRICK_ARENA_MAGIC;
+
+    brickInit(ctx, (char**)(header+1), slab, numBlocks, blockSize);
+
+    return flags;
+}
+
+
+//Unmaps the slab and pointer array of a context set up by brickArenaCreate.
+//brickArenaDestroy :: brickContext* -> Effect
+void brickArenaDestroy(brickContext* ctx) {
+    brickArenaHeader* header = 0;
+
+    if(!ctx->blockptrlist) {
+        return;
+    }
+
+    header = ((brickArenaHeader*)ctx->blockptrlist) - 1;
+    if(header->magic != BRICK_ARENA_MAGIC) {
+        return;
+    }
+    header->magic = 0;
+
+    brickArenaUnmap(ctx->memory, header->slabBytes);
+    brickArenaUnmap(header, header->metaBytes);
+
+    ctx->blockptrlist = 0;
+    ctx->memory       = 0;
+    ctx->numBlocks    = 0;
+}
+
+
+#ifdef BRICK_SHARED
+//Sizes the shared memory file `fd` for `numBlocks` blocks, maps it, and lays out a fresh shared context in it.
+//Returns 1 on success, or 0 if the file couldn't be sized or mapped.
+//brickSharedCreate :: brickContext* -> int -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickSharedCreate(brickContext* ctx, int fd, uint32 numBlocks, uint32 blockSize) {
+    size_t pageSize           = brickArenaPageSize();
+    size_t slabOffset         = (sizeof(brickSharedHeader) + (size_t)numBlocks*sizeof(char*) + pageSize-1) & ~(pageSize-1);
+    size_t mapBytes           = slabOffset + (((size_t)numBlocks*blockSize + pageSize-1) & ~(pageSize-1));
+    brickSharedHeader* header = 0;
+    pthread_mutexattr_t attr;
+
+    if(!numBlocks || !blockSize || (ftruncate(fd, (off_t)mapBytes) != 0)) {
+        return 0;
+    }
+
+    header = (brickSharedHeader*)mmap(0, mapBytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(header == (brickSharedHeader*)MAP_FAILED) {
+        return 0;
+    }
+
+    //robust, so a process dying mid-malloc can't wedge everyone else:
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    header->mapBytes   = mapBytes;
+    header->slabOffset = slabOffset;
+    header->numBlocks  = numBlocks;
+    header->blockSize  = blockSize;
+
+    brickInit(ctx, (char**)(header+1), (char*)header + slabOffset, numBlocks, blockSize);
+    ctx->shared = header;
+
+    //last, so nobody attaches to a half-built context:
+    __atomic_store_n(&header->magic, BRICK_SHARED_MAGIC, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+
+//Maps the shared context another process created in `fd`, leaving its allocations as they are.
+//Returns 1 on success, or 0 if the file couldn't be mapped or doesn't hold a shared context.
+//brickSharedAttach :: brickContext* -> int -> Effect -> uint32
+uint32 brickSharedAttach(brickContext* ctx, int fd) {
+    brickSharedHeader* header = 0;
+    struct stat st;
+
+    if((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(brickSharedHeader))) {
+        return 0;
+    }
+
+    header = (brickSharedHeader*)mmap(0, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(header == (brickSharedHeader*)MAP_FAILED) {
+        return 0;
+    }
+    if((__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != BRICK_SHARED_MAGIC) || (header->mapBytes != (uint64)st.st_size)) {
+        munmap(header, (size_t)st.st_size);
+        return 0;
+    }
+
+    //brickInit with no blocks sets every field, without clearing the live pointer array:
+    brickInit(ctx, (char**)(header+1), (char*)header + header->slabOffset, 0, header->blockSize);
+    ctx->numBlocks = header->numBlocks;
+    ctx->shared    = header;
+
+    return 1;
+}
+
+
+//Unmaps this process's view of a shared context. The file and its allocations stay for the other processes.
+//brickSharedDetach :: brickContext* -> Effect
+void brickSharedDetach(brickContext* ctx) {
+    if(!ctx->shared) {
+        return;
+    }
+
+    munmap(ctx->shared, ctx->shared->mapBytes);
+
+    ctx->shared       = 0;
+    ctx->blockptrlist = 0;
+    ctx->memory       = 0;
+    ctx->numBlocks    = 0;
+}
+#endif //ifdef BRICK_SHARED
+
+
+//---------------------------------------------------------
@@ -0,0 +1,62 @@
+//-----------------------------------------------------------------------------
+// brick_arena.h -- Optional helpers that map memory for a brick context.
+// Copyright (c) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include "types.h"
+#include "brick.h"
+
+#ifndef BRICK_ARENA_H_
+#define BRICK_ARENA_H_
+
+
+//---------------------------------------------------------
+// MACRO DEFINITIONS:
+
+//brickArenaCreate flags:
+//Back the slab with explicit huge pages (MAP_HUGETLB / MEM_LARGE_PAGES), if the OS has any to spare.
+#define BRICK_ARENA_HUGETLB  0x1
+//Align the slab to huge pages and ask for transparent huge pages (MADV_HUGEPAGE).
+#define BRICK_ARENA_THP      0x2
+//Prefault the slab and pointer array up front (MAP_POPULATE), instead of on first touch.
+#define BRICK_ARENA_POPULATE 0x4
+
+//Huge page size the slab is rounded and aligned to. 2 MiB on x86-64 and most arm64 kernels.
+#ifndef BRICK_ARENA_HUGE_PAGE_SIZE
+#define BRICK_ARENA_HUGE_PAGE_SIZE (2*1024*1024)
+#endif
+
+
+//---------------------------------------------------------
+// FUNCTIONS:
+
+//Maps a slab of `numBlocks` blocks and its pointer array, then brickInit's `ctx` over them.
+//Huge page requests fall back to regular pages when they can't be met.
+//Returns the flags that actually took effect, or BRICK_ALLOC_ERROR if no memory could be mapped.
+//brickArenaCreate :: brickContext* -> uint32 -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickArenaCreate(brickContext* ctx, uint32 numBlocks, uint32 blockSize, uint32 flags);
+
+//Unmaps the slab and pointer array of a context set up by brickArenaCreate.
+//brickArenaDestroy :: brickContext* -> Effect
+void brickArenaDestroy(brickContext* ctx);
+
+#ifdef BRICK_SHARED
+//Sizes the shared memory file `fd` for `numBlocks` blocks, maps it, and lays out a fresh shared context in it.
+//Returns 1 on success, or 0 if the file couldn't be sized or mapped.
+//brickSharedCreate :: brickContext* -> int -> uint32 -> uint32 -> Effect -> uint32
+uint32 brickSharedCreate(brickContext* ctx, int fd, uint32 numBlocks, uint32 blockSize);
+
+//Maps the shared context another process created in `fd`, leaving its allocations as they are.
+//Returns 1 on success, or 0 if the file couldn't be mapped or doesn't hold a shared context.
+//brickSharedAttach :: brickContext* -> int -> Effect -> uint32
+uint32 brickSharedAttach(brickContext* ctx, int fd);
+
+//Unmaps this process's view of a shared context. The file and its allocations stay for the other processes.
+//brickSharedDetach :: brickContext* -> Effect
+void brickSharedDetach(brickContext* ctx);
+#endif //ifdef BRICK_SHARED
+
+
+//---------------------------------------------------------
+#endif //ifndef BRICK_ARENA_H_
@@ -0,0 +1,83 @@
+//-----------------------------------------------------------------------------
+// test_brick_arena.c -- Tests for the arena-mapping helpers.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "brick_arena.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_arena_regular_pages() {
+    brickContext bc;
+    uint32 flags;
+    uint32 id1;
+
+    flags = brickArenaCreate(&bc, 1000, 100, 0);
+    ASSERT_EQ(0, flags);
+    ASSERT_EQ(1000, bc.numBlocks);
+    ASSERT_EQ(100, bc.blockSize);
+
+    id1 = brickMalloc(&bc, 100000);
+    ASSERT_EQ(0, id1);
+    memset(brickGetPtr(&bc, id1), 0xAA, 100000);
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 1));
+
+    brickArenaDestroy(&bc);
+    ASSERT(bc.memory == 0);
+
+    PASS();
+}
+
+TEST test_brick_arena_huge_pages_fall_back() {
+    brickContext bc;
+    uint32 flags;
+    uint32 id1;
+
+    //whatever the machine offers, asking for huge pages must still get us an arena:
+    flags = brickArenaCreate(&bc, 4096, 1024, BRICK_ARENA_HUGETLB|BRICK_ARENA_THP|BRICK_ARENA_POPULATE);
+    ASSERTm("Huge page arena could not fall back.", flags != BRICK_ALLOC_ERROR);
+    ASSERTm("Both kinds of huge pages reported.", (flags & (BRICK_ARENA_HUGETLB|BRICK_ARENA_THP)) != (BRICK_ARENA_HUGETLB|BRICK_ARENA_THP));
+    if(flags & (BRICK_ARENA_HUGETLB|BRICK_ARENA_THP)) {
+        ASSERTm("Huge page slab not aligned.", ((size_t)bc.memory & (BRICK_ARENA_HUGE_PAGE_SIZE-1)) == 0);
+    }
+
+    id1 = brickMalloc(&bc, 4096*1024);
+    ASSERT_EQ(0, id1);
+    memset(brickGetPtr(&bc, id1), 0xAA, 4096*1024);
+
+    brickArenaDestroy(&bc);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_arena_regular_pages);
+    RUN_TEST(test_brick_arena_huge_pages_fall_back);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
@@ -0,0 +1,111 @@
+//-----------------------------------------------------------------------------
+// test_brick_block_stack.c -- Tests for the single-block free stack option.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_BLOCK_STACK
+#error BRICK_BLOCK_STACK must be defined for the block-stack test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_block_stack_lifo() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*64];
+    uint32 keys[8];
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 16, 64);
+    for(i = 0; i < 8; i++) {
+        keys[i] = brickMalloc(&bc, 64);
+    }
+
+    //freed single blocks come back most-recent first, not lowest first:
+    brickFree(&bc, keys[1]);
+    brickFree(&bc, keys[5]);
+    brickFree(&bc, keys[3]);
+    ASSERT_EQm("Most recently freed block not reused first.", 3, brickMalloc(&bc, 10));
+    ASSERT_EQ(5, brickMalloc(&bc, 64));
+    ASSERT_EQ(1, brickMalloc(&bc, 1));
+
+    //empty stack: back to the first-fit search.
+    ASSERT_EQ(8, brickMalloc(&bc, 1));
+    ASSERT(refs[8] == memory + 8*64);
+
+    PASS();
+}
+
+TEST test_brick_block_stack_stays_consistent() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*64];
+    uint32 keys[8];
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 16, 64);
+    for(i = 0; i < 8; i++) {
+        keys[i] = brickMalloc(&bc, 64);
+    }
+
+    //blocks 2 and 3 are stacked; a two-block run lands right on them:
+    brickFree(&bc, keys[2]);
+    brickFree(&bc, keys[3]);
+    ASSERT_EQ(2, brickMalloc(&bc, 128));
+    memset(refs[2], 0xFF, 128);
+
+    //...so the stack must not hand either out again:
+    ASSERT_EQm("Block handed out twice.", 8, brickMalloc(&bc, 64));
+    ASSERT(refs[2] == memory + 2*64 && refs[3] == memory + 2*64);
+
+    //runs that can't overlap the stack leave it alone:
+    brickFree(&bc, keys[6]);
+    ASSERT_EQ(9, brickMalloc(&bc, 3*64));
+    ASSERT_EQm("Stack dropped for a disjoint run.", 6, brickMalloc(&bc, 64));
+
+    //calloc through the stack still zeroes, link and all:
+    brickFree(&bc, keys[7]);
+    ASSERT_EQ(7, brickCalloc(&bc, 64));
+    for(i = 0; i < 64; i++) {
+        ASSERT_EQ(0, refs[7][i]);
+    }
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_block_stack_lifo);
+    RUN_TEST(test_brick_block_stack_stays_consistent);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
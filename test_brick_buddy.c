@@ -0,0 +1,135 @@
+//-----------------------------------------------------------------------------
+// test_brick_buddy.c -- Tests for the buddy allocation engine.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_BUDDY
+#error BRICK_BUDDY must be defined for the buddy engine test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_buddy_split_and_merge() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*32];
+    uint32 a, b, c;
+    uint32 i;
+
+    brickInitEngine(&bc, refs, memory, 16, 32, BRICK_ENGINE_BUDDY);
+    ASSERT_EQ(BRICK_ENGINE_BUDDY, bc.engine);
+
+    //3 blocks round up to 4, split off the front of the slab:
+    a = brickMalloc(&bc, 3*32);
+    ASSERT_EQ(0, a);
+    for(i = 0; i < 4; i++) {
+        ASSERT(refs[i] == memory);
+    }
+    ASSERT_EQ(0, refs[4]);
+
+    //the next single block comes from the leftover half of the split:
+    b = brickMalloc(&bc, 1);
+    ASSERT_EQ(4, b);
+    c = brickMalloc(&bc, 8*32);
+    ASSERT_EQ(8, c);
+
+    //nothing order-3 is left until the first half merges back together:
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 8*32));
+    brickFree(&bc, a);
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 8*32));
+    brickFree(&bc, b);
+    ASSERT_EQm("Buddies not merged on free.", 0, brickMalloc(&bc, 8*32));
+
+    PASS();
+}
+
+TEST test_brick_buddy_flat_fallback() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*8];
+
+    //blocks too small for a free-list node keep the flat engine:
+    brickInitEngine(&bc, refs, memory, 16, 8, BRICK_ENGINE_BUDDY);
+    ASSERT_EQ(BRICK_ENGINE_FLAT, bc.engine);
+    ASSERT_EQ(0, brickMalloc(&bc, 3*8));
+    ASSERT_EQ(3, brickMalloc(&bc, 1));
+
+    //and brickInit is always flat:
+    brickInit(&bc, refs, memory, 16, 8);
+    ASSERT_EQ(BRICK_ENGINE_FLAT, bc.engine);
+
+    PASS();
+}
+
+TEST test_brick_buddy_odd_slab() {
+    brickContext bc;
+    char* refs[13];
+    char memory[13*16];
+    uint32 keys[13];
+    uint32 i;
+
+    //13 blocks carve into 8 + 4 + 1:
+    brickInitEngine(&bc, refs, memory, 13, 16, BRICK_ENGINE_BUDDY);
+    ASSERT_EQ(0, brickMalloc(&bc, 5*16));
+    ASSERT_EQ(8, brickMalloc(&bc, 4*16));
+    ASSERT_EQ(12, brickMalloc(&bc, 16));
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 16));
+
+    //free everything, then every block is usable one at a time:
+    brickFree(&bc, 0);
+    brickFree(&bc, 8);
+    brickFree(&bc, 12);
+    for(i = 0; i < 13; i++) {
+        keys[i] = brickCalloc(&bc, 16);
+        ASSERT(keys[i] != BRICK_ALLOC_ERROR);
+        ASSERT(refs[keys[i]] == memory + keys[i]*16);
+    }
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 16));
+
+    //the lone block at the end never merges past the slab:
+    for(i = 0; i < 13; i++) {
+        brickFree(&bc, keys[i]);
+    }
+    ASSERT_EQ(0, brickMalloc(&bc, 8*16));
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 8*16));
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_buddy_split_and_merge);
+    RUN_TEST(test_brick_buddy_flat_fallback);
+    RUN_TEST(test_brick_buddy_odd_slab);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
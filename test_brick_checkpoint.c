@@ -0,0 +1,232 @@
+//-----------------------------------------------------------------------------
+// test_brick_checkpoint.c -- Tests for the checkpoint option.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_CHECKPOINT
+#error BRICK_CHECKPOINT must be defined for the checkpoint test suite.
+#endif
+
+#ifndef BRICK_IOVEC
+#error BRICK_IOVEC must be defined for the checkpoint test suite.
+#endif
+
+#ifndef BRICK_GROWABLE
+#error BRICK_GROWABLE must be defined for the checkpoint test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TEST HELPERS
+
+static brickContext spare;
+static char* spareRefs[8];
+static char spareMemory[8*32];
+
+static brickContext* test_grow(brickContext* ctx, uint32 minBlocks, void* userData) {
+    brickInit(&spare, spareRefs, spareMemory, 8, 32);
+    return &spare;
+}
+
+static void test_release(brickContext* ctx, brickContext* slab, void* userData) {
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_checkpoint_and_restore() {
+    brickContext bc;
+    brickContext restored;
+    uint32 dirtyMap[BRICK_DIRTY_MAP_WORDS(64)];
+    char* refs[64];
+    char* restoredRefs[64];
+    char memory[64*32];
+    char restoredMemory[64*32];
+    FILE* file;
+    int fd;
+    uint32 id1;
+    uint32 id2;
+    uint32 id3;
+    uint32 i;
+
+    file = tmpfile();
+    ASSERT(file != 0);
+    fd = fileno(file);
+
+    memset(memory, 0, sizeof(memory));
+    brickInit(&bc, refs, memory, 64, 32);
+    brickCheckpointAttach(&bc, dirtyMap);
+
+    id1 = brickMalloc(&bc, 100);
+    strcpy(refs[id1], "first allocation");
+    id2 = brickMalloc(&bc, 20);
+    strcpy(refs[id2], "second");
+
+    //the base image covers everything:
+    ASSERT_EQm("Base image was not full.", 64, brickCheckpoint(&bc, fd));
+    ASSERT_EQ(0, brickCheckpoint(&bc, fd));
+
+    //change one allocation in place, free another, and add a third:
+    strcpy(refs[id1], "FIRST");
+    brickMarkDirty(&bc, id1);
+    brickFree(&bc, id2);
+    id3 = brickMalloc(&bc, 40);
+    strcpy(refs[id3], "third");
+
+    //the delta only holds the blocks touched: four for id1, and id2's block reused by id3's two:
+    ASSERT_EQm("Delta wrote more than the dirty blocks.", 6, brickCheckpoint(&bc, fd));
+
+    //replay base + deltas into a fresh context:
+    lseek(fd, 0, SEEK_SET);
+    memset(restoredMemory, 0xAA, sizeof(restoredMemory));
+    brickInit(&restored, restoredRefs, restoredMemory, 64, 32);
+    ASSERT_EQm("Wrong number of checkpoints replayed.", 3, brickRestore(&restored, fd));
+
+    ASSERT_EQ(0, memcmp(memory, restoredMemory, sizeof(memory)));
+    for(i = 0; i < 64; i++) {
+        ASSERT_EQm("Restored metadata differs.", (refs[i] ? refs[i] - memory : -1), (restoredRefs[i] ? restoredRefs[i] - restoredMemory : -1));
+    }
+    ASSERT_STR_EQ("FIRST", restoredRefs[id1]);
+    ASSERT_STR_EQ("third", restoredRefs[id3]);
+
+    fclose(file);
+
+    PASS();
+}
+
+TEST test_brick_restore_rejects_mismatch() {
+    brickContext bc;
+    brickContext other;
+    uint32 dirtyMap[BRICK_DIRTY_MAP_WORDS(8)];
+    char* refs[8];
+    char* otherRefs[16];
+    char memory[8*32];
+    char otherMemory[16*32];
+    FILE* file;
+    int fd;
+
+    file = tmpfile();
+    ASSERT(file != 0);
+    fd = fileno(file);
+
+    brickInit(&bc, refs, memory, 8, 32);
+    brickCheckpointAttach(&bc, dirtyMap);
+    ASSERT_EQ(8, brickCheckpoint(&bc, fd));
+
+    lseek(fd, 0, SEEK_SET);
+    brickInit(&other, otherRefs, otherMemory, 16, 32);
+    ASSERT_EQm("Mismatched geometry was accepted.", BRICK_ALLOC_ERROR, brickRestore(&other, fd));
+
+    fclose(file);
+
+    PASS();
+}
+
+TEST test_brick_checkpoint_refuses_chained_slabs() {
+    brickContext bc;
+    uint32 dirtyMap[BRICK_DIRTY_MAP_WORDS(8)];
+    char* refs[8];
+    char memory[8*32];
+    FILE* file;
+    int fd;
+    uint32 chained;
+
+    file = tmpfile();
+    ASSERT(file != 0);
+    fd = fileno(file);
+
+    brickInit(&bc, refs, memory, 8, 32);
+    brickCheckpointAttach(&bc, dirtyMap);
+    brickSetGrowth(&bc, test_grow, test_release, 0);
+    ASSERT_EQ(0, brickMalloc(&bc, 8*32));
+    chained = brickMalloc(&bc, 32);
+    ASSERT_EQ(1, BRICK_KEY_SLAB(chained));
+
+    //an image of the head alone would lose `chained`:
+    ASSERTm("Checkpoint ignored a chained slab.", brickCheckpoint(&bc, fd) == BRICK_ALLOC_ERROR);
+    ASSERT(brickRestore(&bc, fd) == BRICK_ALLOC_ERROR);
+
+    //once the chain is gone again, checkpoints work:
+    brickFree(&bc, chained);
+    ASSERT_EQ(8, brickCheckpoint(&bc, fd));
+
+    fclose(file);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+TEST test_brick_restore_rebuilds_lengths() {
+    brickContext bc;
+    uint32 dirtyMap[BRICK_DIRTY_MAP_WORDS(8)];
+    uint32 lengths[8];
+    char* refs[8];
+    char memory[8*32];
+    FILE* file;
+    int fd;
+    uint32 id1;
+    uint32 id2;
+
+    file = tmpfile();
+    ASSERT(file != 0);
+    fd = fileno(file);
+
+    brickInit(&bc, refs, memory, 8, 32);
+    brickCheckpointAttach(&bc, dirtyMap);
+    brickLengthsAttach(&bc, lengths);
+    id1 = brickMalloc(&bc, 40);
+    ASSERT_EQ(8, brickCheckpoint(&bc, fd));
+
+    //after the checkpoint, id1 goes away and its blocks get a different, shorter allocation:
+    brickFree(&bc, id1);
+    id2 = brickMalloc(&bc, 10);
+    ASSERT_EQ(id1, id2);
+    ASSERT_EQ(10, brickLength(&bc, id2));
+
+    lseek(fd, 0, SEEK_SET);
+    ASSERT_EQ(1, brickRestore(&bc, fd));
+    ASSERT_EQm("Restore kept a stale length.", 2*32, brickLength(&bc, id1));
+
+    fclose(file);
+
+    PASS();
+}
+
+SUITE(suite) {
+    RUN_TEST(test_brick_checkpoint_and_restore);
+    RUN_TEST(test_brick_restore_rejects_mismatch);
+    RUN_TEST(test_brick_restore_rebuilds_lengths);
+    RUN_TEST(test_brick_checkpoint_refuses_chained_slabs);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
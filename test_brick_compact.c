@@ -0,0 +1,173 @@
+//-----------------------------------------------------------------------------
+// test_brick_compact.c -- Tests for targeted compaction on allocation failure.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_COMPACT
+#error BRICK_COMPACT must be defined for the compaction test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TEST HELPERS
+
+typedef struct relocLog {
+    uint32 count;
+    uint32 oldKeys[8];
+    uint32 newKeys[8];
+} relocLog;
+
+static void test_relocate(brickContext* ctx, uint32 oldKey, uint32 newKey, void* userData) {
+    relocLog* log = (relocLog*)userData;
+
+    if(log->count < 8) {
+        log->oldKeys[log->count] = oldKey;
+        log->newKeys[log->count] = newKey;
+    }
+    log->count++;
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_compact_smallest_window() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*16];
+    relocLog log = {0};
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 16, 16);
+    for(i = 0; i < 16; i++) {
+        ASSERT_EQ(i, brickMalloc(&bc, 16));
+        memset(refs[i], 'a'+i, 16);
+    }
+    brickFree(&bc, 1);
+    brickFree(&bc, 3);
+    brickFree(&bc, 5);
+    brickFree(&bc, 9);
+    brickFree(&bc, 10);
+
+    //no callback, no compaction:
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 3*16));
+
+    //moving blocks 2 and 4 down opens [3, 6); the run at 9 would need three moves:
+    brickSetRelocate(&bc, test_relocate, 0, &log);
+    ASSERT_EQm("Compaction didn't open a run.", 3, brickMalloc(&bc, 3*16));
+    ASSERT_EQ(2, log.count);
+    ASSERT_EQ(2, log.oldKeys[0]);
+    ASSERT_EQ(1, log.newKeys[0]);
+    ASSERT_EQ(4, log.oldKeys[1]);
+    ASSERT_EQ(2, log.newKeys[1]);
+
+    //moved allocations kept their contents; nothing else moved:
+    ASSERT(refs[1] == memory + 1*16 && refs[1][0] == 'c');
+    ASSERT(refs[2] == memory + 2*16 && refs[2][15] == 'e');
+    ASSERT(refs[6] == memory + 6*16 && refs[6][0] == 'g');
+    ASSERT(refs[3] == memory + 3*16 && refs[5] == memory + 3*16);
+
+    PASS();
+}
+
+TEST test_brick_compact_overlapping_move() {
+    brickContext bc;
+    char* refs[8];
+    char memory[8*16];
+    relocLog log = {0};
+    uint32 b;
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 8, 16);
+    brickSetRelocate(&bc, test_relocate, 0, &log);
+    ASSERT_EQ(0, brickMalloc(&bc, 16));
+    b = brickMalloc(&bc, 3*16);
+    ASSERT_EQ(1, b);
+    for(i = 0; i < 3*16; i++) {
+        refs[b][i] = (char)i;
+    }
+    ASSERT_EQ(4, brickMalloc(&bc, 16));
+    ASSERT_EQ(5, brickMalloc(&bc, 16));
+    ASSERT_EQ(6, brickMalloc(&bc, 2*16));
+    brickFree(&bc, 0);
+    brickFree(&bc, 4);
+
+    //the three-block allocation slides one block down, onto itself:
+    ASSERT_EQ(3, brickMalloc(&bc, 2*16));
+    ASSERT_EQ(1, log.count);
+    ASSERT_EQ(1, log.oldKeys[0]);
+    ASSERT_EQ(0, log.newKeys[0]);
+    for(i = 0; i < 3; i++) {
+        ASSERT(refs[i] == memory);
+    }
+    for(i = 0; i < 3*16; i++) {
+        ASSERT_EQ((char)i, refs[0][i]);
+    }
+    ASSERT(refs[3] == memory + 3*16 && refs[4] == memory + 3*16);
+
+    PASS();
+}
+
+TEST test_brick_compact_move_limit() {
+    brickContext bc;
+    char* refs[8];
+    char memory[8*16];
+    relocLog log = {0};
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 8, 16);
+    for(i = 0; i < 8; i++) {
+        brickMalloc(&bc, 16);
+    }
+    brickFree(&bc, 0);
+    brickFree(&bc, 3);
+    brickFree(&bc, 7);
+
+    //opening three blocks would take moving five, over the limit:
+    brickSetRelocate(&bc, test_relocate, 4, &log);
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 3*16));
+    ASSERT_EQ(0, log.count);
+    ASSERT_EQ(0, refs[0]);
+
+    //two blocks is fine: one window needs two moves, the other three.
+    ASSERT_EQ(2, brickMalloc(&bc, 2*16));
+    ASSERT_EQ(2, log.count);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_compact_smallest_window);
+    RUN_TEST(test_brick_compact_overlapping_move);
+    RUN_TEST(test_brick_compact_move_limit);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
@@ -0,0 +1,247 @@
+//-----------------------------------------------------------------------------
+// test_brick_concurrent.c -- Tests for seqlock-protected reads during compaction.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_COMPACT
+#error BRICK_COMPACT must be defined for the concurrent compaction test suite.
+#endif
+
+#ifndef BRICK_CONCURRENT
+#error BRICK_CONCURRENT must be defined for the concurrent compaction test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TEST HELPERS
+
+#define NUM_SLOTS 16
+
+//Key slots the relocation callback keeps current, the way a handle table would.
+typedef struct keyTable {
+    volatile uint32 keys[NUM_SLOTS];
+    uint32 moves;
+    uint32 delay;
+} keyTable;
+
+static void test_relocate(brickContext* ctx, uint32 oldKey, uint32 newKey, void* userData) {
+    keyTable* table = (keyTable*)userData;
+    uint32 i;
+
+    //holds the old key visible after the data has moved, to widen the window a reader could trip over:
+    for(i = 0; i < table->delay; i++) { __atomic_signal_fence(__ATOMIC_SEQ_CST); }
+
+    for(i = 0; i < NUM_SLOTS; i++) {
+        if(table->keys[i] == oldKey) {
+            __atomic_store_n(&table->keys[i], newKey, __ATOMIC_RELEASE);
+        }
+    }
+    table->moves++;
+}
+
+//Fills 64 blocks of 16 bytes with 2-block allocations, then frees every other one.
+//Slot i keeps allocation i (filled with byte 'a'+i); freed slots hold BRICK_ALLOC_ERROR.
+static void test_fragment(brickContext* bc, keyTable* table) {
+    uint32 i;
+
+    for(i = 0; i < NUM_SLOTS; i++) {
+        table->keys[i] = brickMalloc(bc, 32);
+        memset(bc->blockptrlist[table->keys[i]], 'a'+i, 32);
+    }
+    for(i = 0; i < NUM_SLOTS; i += 2) {
+        brickFree(bc, table->keys[i]);
+        table->keys[i] = BRICK_ALLOC_ERROR;
+    }
+}
+
+typedef struct readerArgs {
+    brickContext* ctx;
+    keyTable* table;
+    volatile int stop;
+    uint32 reads;
+    uint32 torn;
+} readerArgs;
+
+static void* test_reader(void* arg) {
+    readerArgs* args = (readerArgs*)arg;
+    char buffer[32];
+    uint32 i, j;
+
+    while(!__atomic_load_n(&args->stop, __ATOMIC_ACQUIRE)) {
+        for(i = 1; i < NUM_SLOTS; i += 2) {
+            if(brickRead(args->ctx, &args->table->keys[i], 0, buffer, 32) != 32) {
+                args->torn++;
+                continue;
+            }
+            for(j = 0; j < 32; j++) {
+                if(buffer[j] != (char)('a'+i)) {
+                    args->torn++;
+                    break;
+                }
+            }
+            __atomic_add_fetch(&args->reads, 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    return 0;
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_read_ranges() {
+    brickContext bc;
+    char* refs[8];
+    char memory[8*16];
+    uint32 seqs[BRICK_SEQ_WORDS(8, 1)] = {0};
+    volatile uint32 key;
+    volatile uint32 bad = 8;
+    char buffer[32];
+
+    brickInit(&bc, refs, memory, 8, 16);
+    brickSeqAttach(&bc, seqs, 1);
+    key = brickMalloc(&bc, 32);
+    memcpy(refs[key], "0123456789abcdefghijklmnopqrstuv", 32);
+
+    ASSERT_EQ(4, brickRead(&bc, &key, 10, buffer, 4));
+    ASSERT_EQ(0, memcmp(buffer, "abcd", 4));
+
+    //reads may run into later blocks of the slab, never past its end:
+    ASSERT_EQ(32, brickRead(&bc, &key, 0, buffer, 32));
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickRead(&bc, &key, 8*16-31, buffer, 32));
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickRead(&bc, &bad, 0, buffer, 1));
+    PASS();
+}
+
+TEST test_brick_compact_step() {
+    brickContext bc;
+    char* refs[64];
+    char memory[64*16];
+    uint32 seqs[BRICK_SEQ_WORDS(64, 2)] = {0};
+    keyTable table = {{0}};
+    char buffer[32];
+    uint32 i, moved, total = 0;
+
+    brickInit(&bc, refs, memory, 64, 16);
+    brickSeqAttach(&bc, seqs, 2);
+    test_fragment(&bc, &table);
+
+    //no callback, no moves:
+    ASSERT_EQ(0, brickCompactStep(&bc, 4));
+
+    brickSetRelocate(&bc, test_relocate, 0, &table);
+    while((moved = brickCompactStep(&bc, 4))) {
+        ASSERTm("A step moved more than it was allowed.", moved <= 4);
+        total += moved;
+    }
+    ASSERT_EQ(8, table.moves);
+    ASSERT_EQ(2*8, total);
+
+    //everything is packed at the front, under its updated key, with its contents:
+    for(i = 1; i < NUM_SLOTS; i += 2) {
+        ASSERT_EQ(i-1, table.keys[i]);
+        ASSERT_EQ(32, brickRead(&bc, &table.keys[i], 0, buffer, 32));
+        ASSERT_EQ('a'+i, buffer[0]);
+        ASSERT_EQ('a'+i, buffer[31]);
+    }
+    ASSERT_EQ(16, brickMalloc(&bc, 48*16));
+
+    //every counter is even again:
+    for(i = 0; i < BRICK_SEQ_WORDS(64, 2); i++) {
+        ASSERT_EQ(0, seqs[i] & 1);
+    }
+    PASS();
+}
+
+TEST test_brick_compact_step_large_allocation() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*16];
+    keyTable table = {{0}};
+
+    brickInit(&bc, refs, memory, 16, 16);
+    brickSetRelocate(&bc, test_relocate, 0, &table);
+    table.keys[0] = brickMalloc(&bc, 16);
+    table.keys[1] = brickMalloc(&bc, 8*16);
+    brickFree(&bc, table.keys[0]);
+    table.keys[0] = BRICK_ALLOC_ERROR;
+
+    //a step always moves at least one allocation, even one over the limit:
+    ASSERT_EQ(8, brickCompactStep(&bc, 2));
+    ASSERT_EQ(0, table.keys[1]);
+    ASSERT_EQ(0, brickCompactStep(&bc, 2));
+    PASS();
+}
+
+TEST test_brick_read_during_compaction() {
+    brickContext bc;
+    char* refs[64];
+    char memory[64*16];
+    uint32 seqs[BRICK_SEQ_WORDS(64, 0)];
+    keyTable table;
+    readerArgs args;
+    pthread_t reader;
+    uint32 round;
+
+    for(round = 0; round < 200; round++) {
+        memset(seqs, 0, sizeof(seqs));
+        memset(&table, 0, sizeof(table));
+        memset(&args, 0, sizeof(args));
+        brickInit(&bc, refs, memory, 64, 16);
+        brickSeqAttach(&bc, seqs, 0);
+        test_fragment(&bc, &table);
+        brickSetRelocate(&bc, test_relocate, 0, &table);
+        table.delay = 20000;
+
+        args.ctx   = &bc;
+        args.table = &table;
+        ASSERT_EQ(0, pthread_create(&reader, 0, test_reader, &args));
+        //let the reader get going before the moves start:
+        while(!__atomic_load_n(&args.reads, __ATOMIC_ACQUIRE)) { continue; }
+        while(brickCompactStep(&bc, 2)) { continue; }
+        __atomic_store_n(&args.stop, 1, __ATOMIC_RELEASE);
+        pthread_join(reader, 0);
+
+        ASSERT_EQm("A reader saw a half-moved allocation.", 0, args.torn);
+        ASSERT_EQ(8, table.moves);
+    }
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_read_ranges);
+    RUN_TEST(test_brick_compact_step);
+    RUN_TEST(test_brick_compact_step_large_allocation);
+    RUN_TEST(test_brick_read_during_compaction);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
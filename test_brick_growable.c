@@ -0,0 +1,152 @@
+//-----------------------------------------------------------------------------
+// test_brick_growable.c -- Tests for the growable-arena option.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_GROWABLE
+#error BRICK_GROWABLE must be defined for the growable-arena test suite.
+#endif
+
+
+//---------------------------------------------------------
+// UTILITY FUNCTIONS
+
+//A tiny pool of spare slabs for the grow callback to hand out.
+typedef struct slabPool {
+    brickContext slabs[2];
+    char* refs[2][8];
+    char memory[2][8*64];
+    uint32 handedOut;
+    uint32 released;
+} slabPool;
+
+static brickContext* poolGrow(brickContext* ctx, uint32 minBlocks, void* userData) {
+    slabPool* pool = (slabPool*)userData;
+    uint32 n       = pool->handedOut;
+
+    if(n >= 2 || minBlocks > 8) {
+        return 0;
+    }
+    pool->handedOut++;
+    brickInit(&pool->slabs[n], pool->refs[n], pool->memory[n], 8, ctx->blockSize);
+
+    return &pool->slabs[n];
+}
+
+static void poolRelease(brickContext* ctx, brickContext* slab, void* userData) {
+    slabPool* pool = (slabPool*)userData;
+
+    pool->released++;
+    pool->handedOut--;
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_exhausted_without_growth() {
+    brickContext bc;
+    char* refs[4];
+    char memory[4*64];
+
+    brickInit(&bc, refs, memory, 4, 64);
+
+    ASSERT(brickMalloc(&bc, 3*64) != BRICK_ALLOC_ERROR);
+    ASSERT_EQm("Exhausted context did not report an error.", BRICK_ALLOC_ERROR, brickMalloc(&bc, 2*64));
+
+    PASS();
+}
+
+TEST test_brick_last_block_run() {
+    brickContext bc;
+    char* refs[4];
+    char memory[4*64];
+
+    brickInit(&bc, refs, memory, 4, 64);
+
+    //a run that starts on the last block is still a run:
+    ASSERT_EQ(0, brickMalloc(&bc, 3*64));
+    ASSERT_EQm("Last free block was not found.", 3, brickMalloc(&bc, 64));
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 64));
+
+    PASS();
+}
+
+TEST test_brick_grow_and_release() {
+    brickContext bc;
+    slabPool pool;
+    char* refs[4];
+    char memory[4*64];
+    uint32 id1;
+    uint32 id2;
+    uint32 id3;
+
+    memset(&pool, 0, sizeof(pool));
+    brickInit(&bc, refs, memory, 4, 64);
+    brickSetGrowth(&bc, poolGrow, poolRelease, &pool);
+
+    //fill the head slab, then spill over into a chained one:
+    id1 = brickMalloc(&bc, 4*64);
+    ASSERT_EQ(0, BRICK_KEY_SLAB(id1));
+
+    id2 = brickMalloc(&bc, 100);
+    ASSERT(id2 != BRICK_ALLOC_ERROR);
+    ASSERT_EQm("Spilled allocation not in slab 1.", 1, BRICK_KEY_SLAB(id2));
+    ASSERT(brickGetPtr(&bc, id2) == pool.memory[0]);
+
+    //too big for any slab we can get:
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 9*64));
+
+    id3 = brickMalloc(&bc, 64);
+    ASSERT_EQ(1, BRICK_KEY_SLAB(id3));
+    ASSERT(brickGetPtr(&bc, id3) == pool.memory[0] + 2*64);
+    ASSERT_EQ(1, pool.handedOut);
+
+    //emptying the trailing slab gives it back:
+    brickFree(&bc, id2);
+    ASSERT_EQ(0, pool.released);
+    brickFree(&bc, id3);
+    ASSERT_EQm("Empty trailing slab was not released.", 1, pool.released);
+    ASSERT(bc.next == 0);
+
+    brickFree(&bc, id1);
+    ASSERT(brickGetPtr(&bc, id1) == 0);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_exhausted_without_growth);
+    RUN_TEST(test_brick_last_block_run);
+    RUN_TEST(test_brick_grow_and_release);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
@@ -0,0 +1,123 @@
+//-----------------------------------------------------------------------------
+// test_brick_iovec.c -- Tests for the iovec-export option.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_IOVEC
+#error BRICK_IOVEC must be defined for the iovec-export test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_lengths() {
+    brickContext bc;
+    uint32 lengths[16];
+    char* refs[16];
+    char memory[16*64];
+    uint32 id1;
+    uint32 id2;
+
+    brickInit(&bc, refs, memory, 16, 64);
+
+    //made before lengths are tracked: counts as whole blocks.
+    id1 = brickMalloc(&bc, 70);
+    brickLengthsAttach(&bc, lengths);
+    ASSERT_EQ(128, brickLength(&bc, id1));
+
+    id2 = brickMalloc(&bc, 70);
+    ASSERT_EQm("Recorded length not kept.", 70, brickLength(&bc, id2));
+
+    brickFree(&bc, id2);
+    ASSERT_EQ(0, brickLength(&bc, id2));
+
+    PASS();
+}
+
+TEST test_brick_iovec_merge_and_trim() {
+    brickContext bc;
+    struct iovec iov[4];
+    uint32 lengths[16];
+    uint32 keys[4];
+    uint32 iovcnt;
+    char* refs[16];
+    char memory[16*64];
+    char out[512];
+    int pipefd[2];
+
+    brickInit(&bc, refs, memory, 16, 64);
+    brickLengthsAttach(&bc, lengths);
+
+    //three back-to-back allocations: full, trimmed, full. The middle one's tail can't merge.
+    keys[0] = brickMalloc(&bc, 128);
+    keys[1] = brickMalloc(&bc, 100);
+    keys[2] = brickMalloc(&bc, 64);
+    memset(refs[keys[0]], 'a', 128);
+    memset(refs[keys[1]], 'b', 100);
+    memset(refs[keys[2]], 'c', 64);
+
+    iovcnt = 4;
+    ASSERT_EQ(3, brickToIovec(&bc, keys, 3, iov, &iovcnt));
+    ASSERT_EQm("Adjacent allocations were not merged.", 2, iovcnt);
+    ASSERT(iov[0].iov_base == memory);
+    ASSERT_EQ(228, iov[0].iov_len);
+    ASSERT(iov[1].iov_base == memory + 4*64);
+    ASSERT_EQ(64, iov[1].iov_len);
+
+    //one writev, no copies:
+    ASSERT_EQ(0, pipe(pipefd));
+    ASSERT_EQ(292, writev(pipefd[1], iov, iovcnt));
+    ASSERT_EQ(292, read(pipefd[0], out, sizeof(out)));
+    ASSERT(out[0] == 'a' && out[127] == 'a' && out[128] == 'b' && out[227] == 'b' && out[228] == 'c');
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    //running out of iovecs stops early:
+    iovcnt = 1;
+    ASSERT_EQm("Export did not stop when iovecs ran out.", 2, brickToIovec(&bc, keys, 3, iov, &iovcnt));
+    ASSERT_EQ(1, iovcnt);
+
+    //so does a free key:
+    brickFree(&bc, keys[1]);
+    iovcnt = 4;
+    ASSERT_EQ(1, brickToIovec(&bc, keys, 3, iov, &iovcnt));
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_lengths);
+    RUN_TEST(test_brick_iovec_merge_and_trim);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
@@ -0,0 +1,172 @@
+//-----------------------------------------------------------------------------
+// test_brick_purge.c -- Tests for the purge option.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_PURGE
+#error BRICK_PURGE must be defined for the purge test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_purge_free_runs() {
+    brickContext bc;
+    uint32 pageSize = (uint32)sysconf(_SC_PAGESIZE);
+    uint32 blockSize = pageSize/4;
+    uint32 purgeMap[BRICK_PURGE_MAP_WORDS(64)];
+    char* refs[64];
+    char* memory;
+    uint32 id1;
+    uint32 id2;
+    uint32 i;
+
+    //16 pages of dirty memory:
+    memory = (char*)mmap(0, 64*blockSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    ASSERT(memory != MAP_FAILED);
+    memset(memory, 0xAA, 64*blockSize);
+
+    brickInit(&bc, refs, memory, 64, blockSize);
+    brickPurgeAttach(&bc, purgeMap, 0, 1);
+
+    //two blocks in use at the start; everything else is free:
+    id1 = brickMalloc(&bc, blockSize);
+    id2 = brickMalloc(&bc, blockSize);
+    ASSERT_EQ(1, id2);
+
+    //nothing to do for runs smaller than what we ask for:
+    ASSERT_EQ(0, brickPurge(&bc, 64*blockSize));
+
+    //the free run [2, 64) holds pages 1 through 15 whole:
+    ASSERT_EQm("Wrong number of bytes purged.", 15*pageSize, brickPurge(&bc, pageSize));
+    for(i = pageSize; i < 64*blockSize; i++) {
+        ASSERT_EQm("Purged page not zeroed.", 0, memory[i]);
+    }
+    ASSERT_EQm("Partially-covered block touched.", (char)0xAA, memory[2*blockSize]);
+
+    //already-purged runs are not purged again:
+    ASSERT_EQ(0, brickPurge(&bc, pageSize));
+
+    //calloc over purged and unpurged blocks still hands back zeroed memory:
+    brickFree(&bc, id1);
+    brickFree(&bc, id2);
+    memset(memory, 0xAA, 4*blockSize);
+    id1 = brickCalloc(&bc, 8*blockSize);
+    ASSERT_EQ(0, id1);
+    for(i = 0; i < 8*blockSize; i++) {
+        ASSERT_EQm("Calloc memory not zeroed.", 0, memory[i]);
+    }
+
+    munmap(memory, 64*blockSize);
+
+    PASS();
+}
+
+TEST test_brick_purge_threshold() {
+    brickContext bc;
+    uint32 pageSize = (uint32)sysconf(_SC_PAGESIZE);
+    uint32 purgeMap[BRICK_PURGE_MAP_WORDS(16)];
+    char* refs[16];
+    char* memory;
+    uint32 id1;
+    uint32 id2;
+
+    memory = (char*)mmap(0, 16*pageSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    ASSERT(memory != MAP_FAILED);
+
+    brickInit(&bc, refs, memory, 16, pageSize);
+    brickPurgeAttach(&bc, purgeMap, 4*pageSize, 1);
+
+    id1 = brickMalloc(&bc, 2*pageSize);
+    id2 = brickMalloc(&bc, 4*pageSize);
+    memset(memory, 0xAA, 6*pageSize);
+
+    //small frees are left alone:
+    brickFree(&bc, id1);
+    ASSERT_EQ((char)0xAA, memory[0]);
+
+    //big ones purge the whole run they join:
+    brickFree(&bc, id2);
+    ASSERT_EQm("Threshold free did not purge.", 0, memory[0]);
+    ASSERT_EQ(0, memory[5*pageSize]);
+
+    munmap(memory, 16*pageSize);
+
+    PASS();
+}
+
+TEST test_brick_purge_file_mapping() {
+    brickContext bc;
+    uint32 pageSize = (uint32)sysconf(_SC_PAGESIZE);
+    uint32 purgeMap[BRICK_PURGE_MAP_WORDS(4)];
+    char* refs[4];
+    char* memory;
+    FILE* file;
+    uint32 i;
+
+    //a private mapping of a file full of 0xAA:
+    file = tmpfile();
+    ASSERT(file != 0);
+    for(i = 0; i < 4*pageSize; i++) {
+        fputc(0xAA, file);
+    }
+    fflush(file);
+    memory = (char*)mmap(0, 4*pageSize, PROT_READ|PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+    ASSERT(memory != MAP_FAILED);
+
+    brickInit(&bc, refs, memory, 4, pageSize);
+    brickPurgeAttach(&bc, purgeMap, 0, 0);
+    ASSERT_EQ(4*pageSize, brickPurge(&bc, pageSize));
+
+    //purged pages read back as the file, so calloc still has to zero them:
+    ASSERT_EQ((char)0xAA, memory[0]);
+    ASSERT_EQ(0, brickCalloc(&bc, 4*pageSize));
+    for(i = 0; i < 4*pageSize; i++) {
+        ASSERT_EQm("Calloc trusted a purged file page.", 0, memory[i]);
+    }
+
+    munmap(memory, 4*pageSize);
+    fclose(file);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_purge_free_runs);
+    RUN_TEST(test_brick_purge_threshold);
+    RUN_TEST(test_brick_purge_file_mapping);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
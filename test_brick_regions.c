@@ -0,0 +1,144 @@
+//-----------------------------------------------------------------------------
+// test_brick_regions.c -- Tests for scoped mark/release regions.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_REGIONS
+#error BRICK_REGIONS must be defined for the region test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_regions_nested() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*32];
+    uint32 log[8];
+    uint32 outer, inner;
+    uint32 keep;
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 16, 32);
+    brickRegionAttach(&bc, log, 8);
+
+    //allocations outside any scope aren't recorded:
+    keep = brickMalloc(&bc, 32);
+
+    outer = brickMark(&bc);
+    ASSERT(outer != BRICK_ALLOC_ERROR);
+    ASSERT_EQ(1, brickMalloc(&bc, 2*32));
+    inner = brickMark(&bc);
+    ASSERT_EQ(3, brickCalloc(&bc, 32));
+    ASSERT_EQ(4, brickMalloc(&bc, 3*32));
+
+    //releasing the inner scope leaves the outer one's allocations alone:
+    ASSERT_EQ(2, brickRelease(&bc, inner));
+    for(i = 3; i < 7; i++) {
+        ASSERT_EQ(0, refs[i]);
+    }
+    ASSERT(refs[1] == memory + 32);
+    ASSERTm("Inner token still valid after release.", brickRelease(&bc, inner) == BRICK_ALLOC_ERROR);
+
+    ASSERT_EQ(1, brickRelease(&bc, outer));
+    for(i = 1; i < 16; i++) {
+        ASSERT_EQ(0, refs[i]);
+    }
+    ASSERT(refs[keep] == memory);
+
+    //with no scope open, mallocs are not recorded again:
+    ASSERT(brickMalloc(&bc, 32) != BRICK_ALLOC_ERROR);
+    ASSERT_EQ(0, bc.regionLength);
+
+    PASS();
+}
+
+TEST test_brick_regions_outer_release_closes_inner() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*32];
+    uint32 log[8];
+    uint32 outer;
+
+    brickInit(&bc, refs, memory, 16, 32);
+    brickRegionAttach(&bc, log, 8);
+
+    outer = brickMark(&bc);
+    brickMalloc(&bc, 32);
+    brickMark(&bc);
+    brickMalloc(&bc, 32);
+    brickMark(&bc);
+    brickMalloc(&bc, 32);
+
+    ASSERT_EQ(3, brickRelease(&bc, outer));
+    ASSERT_EQ(0, bc.regionDepth);
+    ASSERT_EQ(0, refs[0]);
+    ASSERT_EQ(0, refs[2]);
+
+    PASS();
+}
+
+TEST test_brick_regions_log_full() {
+    brickContext bc;
+    char* refs[16];
+    char memory[16*32];
+    uint32 log[3];
+    uint32 scope;
+
+    brickInit(&bc, refs, memory, 16, 32);
+
+    //no log attached, no scopes:
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMark(&bc));
+
+    brickRegionAttach(&bc, log, 3);
+    scope = brickMark(&bc);
+    ASSERT_EQ(0, brickMalloc(&bc, 32));
+    ASSERT_EQ(1, brickMalloc(&bc, 32));
+
+    //an allocation the scope couldn't track is refused, not leaked:
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 32));
+    ASSERT_EQ(0, refs[2]);
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMark(&bc));
+
+    ASSERT_EQ(2, brickRelease(&bc, scope));
+    ASSERT_EQ(0, refs[0]);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_regions_nested);
+    RUN_TEST(test_brick_regions_outer_release_closes_inner);
+    RUN_TEST(test_brick_regions_log_full);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
@@ -0,0 +1,143 @@
+//-----------------------------------------------------------------------------
+// test_brick_scatter.c -- Tests for the scatter-allocation option.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_SCATTER
+#error BRICK_SCATTER must be defined for the scatter-allocation test suite.
+#endif
+
+
+//---------------------------------------------------------
+// UTILITY FUNCTIONS
+
+//Fills 16 blocks with 2-block allocations, then frees every other one: four 2-block holes.
+static void fragment(brickContext* bc, char** refs, char* memory) {
+    uint32 keys[8];
+    uint32 i;
+
+    brickInit(bc, refs, memory, 16, 64);
+    for(i = 0; i < 8; i++) {
+        keys[i] = brickMalloc(bc, 128);
+    }
+    for(i = 0; i < 8; i += 2) {
+        brickFree(bc, keys[i]);
+    }
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_scatter_contiguous_first() {
+    brickContext bc;
+    brickScatter sg;
+    brickSegment segments[4];
+    char* refs[16];
+    char memory[16*64];
+
+    brickInit(&bc, refs, memory, 16, 64);
+
+    ASSERT_EQ(1, brickMallocScatter(&bc, 300, &sg, segments, 4));
+    ASSERT_EQ(0, segments[0].key);
+    ASSERT_EQ(5, segments[0].blocks);
+
+    brickFreeScatter(&bc, &sg);
+    ASSERT(refs[0] == 0);
+
+    PASS();
+}
+
+TEST test_brick_scatter_fragmented() {
+    brickContext bc;
+    brickScatter sg;
+    brickSegment segments[4];
+    char* refs[16];
+    char memory[16*64];
+    uint32 contiguous;
+
+    fragment(&bc, refs, memory);
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 6*64));
+
+    ASSERT_EQm("Scatter allocation failed despite enough free blocks.", 3, brickMallocScatter(&bc, 6*64, &sg, segments, 4));
+    ASSERT_EQ(0, segments[0].key);
+    ASSERT_EQ(4, segments[1].key);
+    ASSERT_EQ(8, segments[2].key);
+
+    //offset -> pointer translation:
+    ASSERT(brickScatterPtr(&bc, &sg, 0, &contiguous) == memory);
+    ASSERT_EQ(128, contiguous);
+    ASSERT(brickScatterPtr(&bc, &sg, 130, &contiguous) == memory + 4*64 + 2);
+    ASSERT_EQ(126, contiguous);
+    ASSERT(brickScatterPtr(&bc, &sg, 6*64, 0) == 0);
+
+    brickFreeScatter(&bc, &sg);
+    ASSERT(refs[0] == 0 && refs[5] == 0 && refs[9] == 0);
+    ASSERT(refs[12] == 0 && refs[13] == 0);
+
+    //offsets stop at the requested size, not at the end of the last block:
+    ASSERT_EQ(3, brickMallocScatter(&bc, 6*64-10, &sg, segments, 4));
+    ASSERT(brickScatterPtr(&bc, &sg, 5*64, &contiguous) == memory + 8*64 + 64);
+    ASSERT_EQ(54, contiguous);
+    ASSERT(brickScatterPtr(&bc, &sg, 6*64-10, 0) == 0);
+    brickFreeScatter(&bc, &sg);
+
+    PASS();
+}
+
+TEST test_brick_scatter_rolls_back() {
+    brickContext bc;
+    brickScatter sg;
+    brickSegment segments[2];
+    char* refs[16];
+    char memory[16*64];
+    uint32 i;
+
+    fragment(&bc, refs, memory);
+
+    //not enough segments to cover it, and not enough free blocks at all:
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMallocScatter(&bc, 6*64, &sg, segments, 2));
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMallocScatter(&bc, 9*64, &sg, segments, 2));
+
+    for(i = 0; i < 16; i += 4) {
+        ASSERTm("Failed scatter allocation leaked blocks.", refs[i] == 0 && refs[i+1] == 0);
+    }
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_scatter_contiguous_first);
+    RUN_TEST(test_brick_scatter_fragmented);
+    RUN_TEST(test_brick_scatter_rolls_back);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
@@ -0,0 +1,143 @@
+//-----------------------------------------------------------------------------
+// test_brick_shared.c -- Tests for process-shared contexts.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "brick.h"
+#include "brick_arena.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_SHARED
+#error BRICK_SHARED must be defined for the shared context test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TEST HELPERS
+
+//An anonymous shared memory file, standing in for shm_open().
+static int test_shm_fd(void) {
+    char name[64];
+    int fd = 0;
+
+    snprintf(name, sizeof(name), "/brick_test_%d", (int)getpid());
+    fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+    shm_unlink(name);
+
+    return fd;
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_shared_keys_cross_processes() {
+    brickContext bc;
+    pid_t child;
+    int status = 0;
+    int fd     = test_shm_fd();
+    uint32 key = 0;
+
+    ASSERT(fd >= 0);
+    ASSERT_EQ(1, brickSharedCreate(&bc, fd, 64, 128));
+    ASSERT_EQ(0, brickMalloc(&bc, 128));
+
+    //the child maps the file again (at its own address) and hands back a key:
+    child = fork();
+    if(child == 0) {
+        brickContext peer;
+        uint32 k = 0;
+
+        if(!brickSharedAttach(&peer, fd) || (peer.numBlocks != 64) || (peer.blockSize != 128)) {
+            _exit(255);
+        }
+        k = brickMalloc(&peer, 3*128);
+        strcpy(brickGetPtr(&peer, k), "written by the child");
+        brickSharedDetach(&peer);
+        _exit((int)k);
+    }
+    ASSERT(child > 0);
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    ASSERT(WIFEXITED(status));
+    key = (uint32)WEXITSTATUS(status);
+
+    ASSERT_EQm("Child saw a different allocation state.", 1, key);
+    ASSERT_STR_EQ("written by the child", brickGetPtr(&bc, key));
+    ASSERT(brickGetPtr(&bc, key) == bc.memory + 128);
+
+    //and frees from either side are seen by the other:
+    brickFree(&bc, key);
+    ASSERT_EQ(1, brickMalloc(&bc, 128));
+
+    brickSharedDetach(&bc);
+    close(fd);
+    PASS();
+}
+
+TEST test_brick_shared_robust_lock() {
+    brickContext bc;
+    brickContext other;
+    pid_t child;
+    int status = 0;
+    int fd     = test_shm_fd();
+
+    ASSERT_EQ(1, brickSharedCreate(&bc, fd, 16, 64));
+
+    //a process dies holding the lock:
+    child = fork();
+    if(child == 0) {
+        pthread_mutex_lock(&bc.shared->lock);
+        _exit(0);
+    }
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+
+    ASSERTm("Lock left dead by its owner.", brickMalloc(&bc, 64) == 0);
+    brickFree(&bc, 0);
+    brickSharedDetach(&bc);
+
+    //files without a shared context are refused:
+    ASSERT_EQ(0, ftruncate(fd, 0));
+    ASSERT_EQ(0, ftruncate(fd, 4096));
+    ASSERT_EQ(0, brickSharedAttach(&other, fd));
+
+    close(fd);
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_shared_keys_cross_processes);
+    RUN_TEST(test_brick_shared_robust_lock);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
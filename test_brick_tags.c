@@ -0,0 +1,148 @@
+//-----------------------------------------------------------------------------
+// test_brick_tags.c -- Tests for tagged allocations, quotas and free by tag.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_TAGS
+#error BRICK_TAGS must be defined for the tagging test suite.
+#endif
+
+#ifndef BRICK_BUDDY
+#error BRICK_BUDDY must be defined for the tagging test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_tags_counts_and_free_by_tag() {
+    brickContext bc;
+    char* refs[32];
+    char memory[32*16];
+    brickTag tags[2];
+    brickTagLink links[32];
+    uint32 a0, a1, b0, a2, plain;
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 32, 16);
+    brickTagAttach(&bc, tags, 2, links);
+
+    a0    = brickMallocTagged(&bc, 16, 0);
+    b0    = brickMallocTagged(&bc, 3*16, 1);
+    a1    = brickMallocTagged(&bc, 2*16, 0);
+    plain = brickMalloc(&bc, 16);
+    a2    = brickMallocTagged(&bc, 17, 0);
+    ASSERT_EQ(5, brickTagBlocks(&bc, 0));
+    ASSERT_EQ(3, brickTagBlocks(&bc, 1));
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMallocTagged(&bc, 16, 2));
+
+    //freeing one allocation on its own unlinks it from the middle of its list:
+    brickFree(&bc, a1);
+    ASSERT_EQ(3, brickTagBlocks(&bc, 0));
+
+    //freeing a tag leaves everything else alone:
+    ASSERT_EQ(2, brickFreeTag(&bc, 0));
+    ASSERT_EQ(0, brickTagBlocks(&bc, 0));
+    ASSERT(refs[a0] == 0 && refs[a2] == 0 && refs[a2+1] == 0);
+    ASSERT(refs[b0] == memory + b0*16);
+    ASSERT(refs[plain] == memory + plain*16);
+    ASSERT_EQ(0, brickFreeTag(&bc, 0));
+
+    ASSERT_EQ(1, brickFreeTag(&bc, 1));
+    for(i = 0; i < 32; i++) {
+        ASSERT(i == plain || refs[i] == 0);
+    }
+
+    PASS();
+}
+
+TEST test_brick_tags_quota() {
+    brickContext bc;
+    char* refs[32];
+    char memory[32*16];
+    brickTag tags[2];
+    brickTagLink links[32];
+    uint32 k;
+
+    brickInit(&bc, refs, memory, 32, 16);
+    brickTagAttach(&bc, tags, 2, links);
+    brickTagSetQuota(&bc, 0, 4);
+
+    k = brickMallocTagged(&bc, 3*16, 0);
+    ASSERT(k != BRICK_ALLOC_ERROR);
+    ASSERTm("Quota not enforced.", brickMallocTagged(&bc, 2*16, 0) == BRICK_ALLOC_ERROR);
+    ASSERT(brickMallocTagged(&bc, 16, 0) != BRICK_ALLOC_ERROR);
+    ASSERT(brickMallocTagged(&bc, 16, 0) == BRICK_ALLOC_ERROR);
+
+    //other tags are unaffected, and room comes back on free:
+    ASSERT(brickMallocTagged(&bc, 8*16, 1) != BRICK_ALLOC_ERROR);
+    brickFree(&bc, k);
+    ASSERT(brickMallocTagged(&bc, 3*16, 0) != BRICK_ALLOC_ERROR);
+    ASSERT_EQ(4, brickTagBlocks(&bc, 0));
+
+    PASS();
+}
+
+TEST test_brick_tags_quota_buddy() {
+    brickContext bc;
+    char* refs[32];
+    char memory[32*16];
+    brickTag tags[1];
+    brickTagLink links[32];
+    uint32 k;
+
+    brickInitEngine(&bc, refs, memory, 32, 16, BRICK_ENGINE_BUDDY);
+    brickTagAttach(&bc, tags, 1, links);
+    brickTagSetQuota(&bc, 0, 4);
+
+    //3 blocks reserve 4 in a buddy slab, and are charged as 4:
+    k = brickMallocTagged(&bc, 3*16, 0);
+    ASSERT(k != BRICK_ALLOC_ERROR);
+    ASSERT_EQm("Buddy rounding not charged.", 4, brickTagBlocks(&bc, 0));
+    ASSERT(brickMallocTagged(&bc, 16, 0) == BRICK_ALLOC_ERROR);
+
+    //a request under the quota that rounds up past it fails, and leaves nothing allocated:
+    brickFree(&bc, k);
+    brickTagSetQuota(&bc, 0, 3);
+    ASSERT(brickMallocTagged(&bc, 3*16, 0) == BRICK_ALLOC_ERROR);
+    ASSERT_EQ(0, brickTagBlocks(&bc, 0));
+    ASSERT(refs[0] == 0 && refs[3] == 0);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_tags_counts_and_free_by_tag);
+    RUN_TEST(test_brick_tags_quota);
+    RUN_TEST(test_brick_tags_quota_buddy);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
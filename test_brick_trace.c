@@ -0,0 +1,140 @@
+//-----------------------------------------------------------------------------
+// test_brick_trace.c -- Tests for the tracing option.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_TRACE
+#error BRICK_TRACE must be defined for the trace test suite.
+#endif
+
+
+//---------------------------------------------------------
+// UTILITY FUNCTIONS
+
+static uint32 hookCalls = 0;
+
+static void countingHook(brickContext* ctx, const brickTraceEvent* ev, void* userData) {
+    hookCalls++;
+    *(uint32*)userData = ev->op;
+}
+
+static void drainAll(void) {
+    brickTraceEvent scratch[BRICK_TRACE_RING_SIZE];
+    while(brickTraceDrain(brickTraceThreadRing(), scratch, BRICK_TRACE_RING_SIZE)) { continue; }
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_trace_events() {
+    brickContext bc;
+    brickTraceEvent events[8];
+    char* refs[24];
+    uint32 lastOp = 0;
+    uint32 id1;
+    uint32 id2;
+    uint32 n;
+
+    //allocate our intial block of memory:
+    void* memref = malloc(24*64);
+
+    drainAll();
+    hookCalls = 0;
+
+    //initialize brick context and attach a hook:
+    brickInit(&bc, refs, (char*)memref, 24, 64);
+    brickTraceSetHook(&bc, countingHook, &lastOp);
+
+    id1 = brickMalloc(&bc, 91);
+    id2 = brickMalloc(&bc, 23);
+    brickFree(&bc, id1);
+    brickGC(&bc);
+
+    ASSERT_EQm("Hook not called for every operation.", 4, hookCalls);
+    ASSERT_EQm("Hook saw the wrong last operation.", BRICK_OP_GC, lastOp);
+
+    //drain the ring and check what was recorded:
+    n = brickTraceDrain(brickTraceThreadRing(), events, 8);
+    ASSERT_EQ(4, n);
+    ASSERT_EQ(BRICK_OP_MALLOC, events[0].op);
+    ASSERT_EQ(id1, events[0].key);
+    ASSERT_EQ(2, events[0].blocks);
+    ASSERT_EQ(BRICK_OP_MALLOC, events[1].op);
+    ASSERT_EQ(id2, events[1].key);
+    ASSERT_EQ(1, events[1].blocks);
+    ASSERT_EQ(BRICK_OP_FREE, events[2].op);
+    ASSERT_EQ(id1, events[2].key);
+    ASSERT_EQ(2, events[2].blocks);
+    ASSERT_EQ(BRICK_OP_GC, events[3].op);
+    ASSERT(events[0].ctx == &bc);
+
+    //ring is now empty:
+    ASSERT_EQ(0, brickTraceDrain(brickTraceThreadRing(), events, 8));
+
+    free(memref);
+
+    PASS();
+}
+
+TEST test_brick_trace_ring_full() {
+    brickContext bc;
+    brickTraceRing* ring = brickTraceThreadRing();
+    char* refs[4];
+    uint32 dropped;
+    uint32 i;
+
+    void* memref = malloc(4*64);
+
+    drainAll();
+    dropped = ring->dropped;
+
+    brickInit(&bc, refs, (char*)memref, 4, 64);
+
+    //each malloc+free pair logs two events; overflow the ring by ten:
+    for(i = 0; i < (BRICK_TRACE_RING_SIZE/2) + 5; i++) {
+        brickFree(&bc, brickMalloc(&bc, 10));
+    }
+
+    ASSERT_EQm("Overflowing events were not counted.", dropped + 10, ring->dropped);
+
+    drainAll();
+    free(memref);
+
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_trace_events);
+    RUN_TEST(test_brick_trace_ring_full);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}
@@ -0,0 +1,259 @@
+//-----------------------------------------------------------------------------
+// test_brick_wait.c -- Tests for waiting (blocking and async) allocations.
+// Copyright (C) Philip Conrad 5/13/2013 @ 12:14 PM -- MIT License
+//
+//-----------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "brick.h"
+#include "greatest.h"
+
+
+//---------------------------------------------------------
+// MACRO DEFINITION CHECK
+
+#ifndef BRICK_WAIT
+#error BRICK_WAIT must be defined for the waiting allocation test suite.
+#endif
+
+#ifndef BRICK_COMPACT
+#error BRICK_COMPACT must be defined for the waiting allocation test suite.
+#endif
+
+#ifndef BRICK_BUDDY
+#error BRICK_BUDDY must be defined for the waiting allocation test suite.
+#endif
+
+
+//---------------------------------------------------------
+// TEST HELPERS
+
+typedef struct serveLog {
+    uint32 count;
+    brickWaiter* waiters[4];
+    uint32 keys[4];
+} serveLog;
+
+static void test_served(brickContext* ctx, brickWaiter* waiter, uint32 key, void* userData) {
+    serveLog* log = (serveLog*)userData;
+
+    log->waiters[log->count] = waiter;
+    log->keys[log->count]    = key;
+    log->count++;
+}
+
+typedef struct freeLater {
+    brickContext* ctx;
+    uint32 key;
+} freeLater;
+
+static void test_relocate(brickContext* ctx, uint32 oldKey, uint32 newKey, void* userData) {
+    (*(uint32*)userData)++;
+}
+
+static void* test_free_later(void* arg) {
+    freeLater* job = (freeLater*)arg;
+
+    usleep(20*1000);
+    brickLock(job->ctx);
+    brickFree(job->ctx, job->key);
+    brickUnlock(job->ctx);
+
+    return 0;
+}
+
+
+//---------------------------------------------------------
+// TESTS
+
+TEST test_brick_wait_async_fifo() {
+    brickContext bc;
+    char* refs[8];
+    char memory[8*16];
+    brickWaiter a, b;
+    serveLog log = {0};
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 8, 16);
+    for(i = 0; i < 8; i++) {
+        brickMalloc(&bc, 16);
+    }
+
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMallocAsync(&bc, 9*16, &a, test_served, &log));
+    ASSERT_EQ(BRICK_ALLOC_PENDING, brickMallocAsync(&bc, 2*16, &a, test_served, &log));
+    ASSERT_EQ(BRICK_ALLOC_PENDING, brickMallocAsync(&bc, 16, &b, test_served, &log));
+
+    //single free blocks don't fit the oldest waiter, and the one behind it has to wait its turn:
+    brickFree(&bc, 0);
+    brickFree(&bc, 5);
+    ASSERT_EQ(0, log.count);
+
+    //a two-block run serves both, in order:
+    brickFree(&bc, 1);
+    ASSERT_EQ(2, log.count);
+    ASSERT(log.waiters[0] == &a && log.keys[0] == 0);
+    ASSERT(log.waiters[1] == &b && log.keys[1] == 5);
+    ASSERT_EQ(0, a.key);
+    ASSERT(refs[1] == memory && refs[5] == memory + 5*16);
+    ASSERT(bc.waitHead == 0 && bc.waitTail == 0);
+
+    //an empty queue means no waiting:
+    brickFree(&bc, 7);
+    ASSERT_EQ(7, brickMallocAsync(&bc, 16, &a, test_served, &log));
+    ASSERT_EQ(2, log.count);
+
+    brickWaitDestroy(&bc);
+    PASS();
+}
+
+TEST test_brick_wait_cancel() {
+    brickContext bc;
+    char* refs[8];
+    char memory[8*16];
+    brickWaiter a, b;
+    serveLog log = {0};
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 8, 16);
+    for(i = 0; i < 8; i++) {
+        brickMalloc(&bc, 16);
+    }
+
+    ASSERT_EQ(BRICK_ALLOC_PENDING, brickMallocAsync(&bc, 4*16, &a, test_served, &log));
+    ASSERT_EQ(BRICK_ALLOC_PENDING, brickMallocAsync(&bc, 16, &b, test_served, &log));
+    brickFree(&bc, 3);
+    ASSERT_EQ(0, log.count);
+
+    //once the big request gives up, the one behind it fits right away:
+    ASSERT_EQ(1, brickWaitCancel(&bc, &a));
+    ASSERT_EQ(1, log.count);
+    ASSERT(log.waiters[0] == &b && log.keys[0] == 3);
+    ASSERT_EQ(0, brickWaitCancel(&bc, &b));
+
+    brickWaitDestroy(&bc);
+    PASS();
+}
+
+TEST test_brick_wait_blocking() {
+    brickContext bc;
+    char* refs[8];
+    char memory[8*16];
+    freeLater job;
+    pthread_t thread;
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 8, 16);
+    for(i = 0; i < 8; i++) {
+        brickMalloc(&bc, 16);
+    }
+
+    brickLock(&bc);
+
+    //nobody frees: times out, and leaves nothing queued.
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMallocWait(&bc, 16, 10));
+    ASSERT(bc.waitHead == 0);
+
+    //another thread frees block 6 while we wait:
+    job.ctx = &bc;
+    job.key = 6;
+    ASSERT_EQ(0, pthread_create(&thread, 0, test_free_later, &job));
+    ASSERT_EQm("Waiter not woken by brickFree.", 6, brickMallocWait(&bc, 16, BRICK_WAIT_FOREVER));
+    brickUnlock(&bc);
+    pthread_join(thread, 0);
+
+    brickWaitDestroy(&bc);
+    PASS();
+}
+
+TEST test_brick_wait_compaction() {
+    brickContext bc;
+    char* refs[8];
+    char memory[8*16];
+    brickWaiter a;
+    serveLog log = {0};
+    uint32 moves = 0;
+    uint32 i;
+
+    brickInit(&bc, refs, memory, 8, 16);
+    brickSetRelocate(&bc, test_relocate, 0, &moves);
+    for(i = 0; i < 8; i++) {
+        brickMalloc(&bc, 16);
+    }
+
+    ASSERT_EQ(BRICK_ALLOC_PENDING, brickMallocAsync(&bc, 3*16, &a, test_served, &log));
+
+    //a plain malloc can't jump the queue, even with a free block right there:
+    brickFree(&bc, 1);
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMalloc(&bc, 16));
+    brickFree(&bc, 3);
+    ASSERT_EQ(0, log.count);
+
+    //no run of 3 ever opens, but there are now 3 free blocks to compact into one:
+    brickFree(&bc, 5);
+    ASSERT_EQm("Waiter not served by compaction.", 1, log.count);
+    ASSERT(log.keys[0] != BRICK_ALLOC_ERROR && moves > 0);
+    ASSERT(bc.waitHead == 0);
+
+    brickWaitDestroy(&bc);
+    PASS();
+}
+
+TEST test_brick_wait_buddy_limit() {
+    brickContext bc;
+    char* refs[48];
+    char memory[48*64];
+    brickWaiter a;
+    serveLog log = {0};
+    uint32 key;
+
+    brickInitEngine(&bc, refs, memory, 48, 64, BRICK_ENGINE_BUDDY);
+
+    //40 blocks fit the slab, but no aligned power of two above 32 does: fail now rather than queue forever.
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMallocAsync(&bc, 40*64, &a, test_served, &log));
+    ASSERT(bc.waitHead == 0);
+    brickLock(&bc);
+    ASSERT_EQ(BRICK_ALLOC_ERROR, brickMallocWait(&bc, 40*64, BRICK_WAIT_FOREVER));
+    brickUnlock(&bc);
+    key = brickMalloc(&bc, 32*64);
+    ASSERT_EQm("Later malloc blocked by an impossible waiter.", 0, key);
+
+    //32 blocks is the largest the slab can hold, so that one still waits:
+    ASSERT_EQ(BRICK_ALLOC_PENDING, brickMallocAsync(&bc, 32*64, &a, test_served, &log));
+    brickFree(&bc, key);
+    ASSERT_EQm("Waiter not served by brickFree.", 1, log.count);
+    ASSERT_EQ(0, log.keys[0]);
+
+    brickWaitDestroy(&bc);
+    PASS();
+}
+
+
+//---------------------------------------------------------
+// SUITE
+
+SUITE(suite) {
+    RUN_TEST(test_brick_wait_async_fifo);
+    RUN_TEST(test_brick_wait_cancel);
+    RUN_TEST(test_brick_wait_blocking);
+    RUN_TEST(test_brick_wait_compaction);
+    RUN_TEST(test_brick_wait_buddy_limit);
+}
+
+
+//---------------------------------------------------------
+// MAIN
+
+/* Add all the definitions that need to be in the test runner's main file. */
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
+    RUN_SUITE(suite);
+    GREATEST_MAIN_END();        /* display results */
+}